@@ -1925,6 +1925,13 @@ fi
 #
 # Environment: library functions
 #
+ac_test copy_file_range <<-'EOF'
+	#include <sys/types.h>
+	#include <unistd.h>
+	int main(void) { return ((int)copy_file_range(0, NULL, 1, NULL,
+	    512, 0)); }
+EOF
+
 ac_test dprintf <<-'EOF'
 	#include <stdio.h>
 	int main(void) { return (dprintf(1, "hi\n")); }
@@ -1946,6 +1953,12 @@ ac_test fchownat <<-'EOF'
 	    0, 0, AT_SYMLINK_NOFOLLOW)); }
 EOF
 
+ac_test ficlone copy_file_range 0 'for the FICLONE ioctl' <<-'EOF'
+	#include <sys/ioctl.h>
+	#include <linux/fs.h>
+	int main(void) { return (ioctl(1, FICLONE, 0)); }
+EOF
+
 ac_test futimens <<-'EOF'
 	#include <sys/types.h>
 	#include <sys/stat.h>
@@ -1973,16 +1986,44 @@ ac_test linkat <<-'EOF'
 	    AT_FDCWD, av[2], ac)); }
 EOF
 
+ac_test openat '' 'for openat and the other *at functions' <<-'EOF'
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	int main(int ac, char *av[]) {
+		struct stat sb;
+		int fd = openat(AT_FDCWD, av[0], O_RDONLY);
+		return (mkdirat(fd, av[1], ac) + mknodat(fd, av[1], ac, 0) +
+		    mkfifoat(fd, av[1], ac) + symlinkat(av[0], fd, av[1]) +
+		    fstatat(fd, av[1], &sb, AT_SYMLINK_NOFOLLOW) +
+		    faccessat(fd, av[1], ac, 0) + unlinkat(fd, av[1], ac));
+	}
+EOF
+
 ac_test pledge <<-'EOF'
 	#include <unistd.h>
 	int main(void) { return (pledge("", "")); }
 EOF
 
+ac_test posix_fadvise <<-'EOF'
+	#include <fcntl.h>
+	int main(void) { return (posix_fadvise(0, 0, 0,
+	    POSIX_FADV_SEQUENTIAL)); }
+EOF
+
 ac_test reallocarray <<-'EOF'
 	#include <stdlib.h>
 	int main(void) { return ((void *)reallocarray(NULL, 3, 3) == (void *)0UL); }
 EOF
 
+ac_test seek_data '' 'for SEEK_DATA and SEEK_HOLE' <<-'EOF'
+	#include <sys/types.h>
+	#include <unistd.h>
+	int main(void) { return ((int)lseek(0, lseek(0, 0, SEEK_DATA),
+	    SEEK_HOLE)); }
+EOF
+
 ac_test setpgent grp_h 0 'for setpassent and setgroupent' <<-'EOF'
 	#include <sys/types.h>
 	#include <grp.h>
@@ -2064,6 +2105,23 @@ ac_test futimes '!' futimens 0 <<-'EOF'
 	int main(void) { return (futimes(0, tv)); }
 EOF
 
+#
+# Environment: optional libraries
+#
+save_LIBS=$LIBS
+LIBS="$LIBS -lz"
+ac_test zlib '' 'for zlib (in-process gzip)' <<-'EOF'
+	#include <zlib.h>
+	int main(void) {
+		z_stream zs;
+		zs.zalloc = Z_NULL;
+		zs.zfree = Z_NULL;
+		zs.opaque = Z_NULL;
+		return (inflateInit2(&zs, 15 + 32));
+	}
+EOF
+test 1 = $HAVE_ZLIB || LIBS=$save_LIBS
+
 #
 # check headers for declarations
 #
@@ -54,6 +54,9 @@
 #include <strings.h>
 #endif
 #include <unistd.h>
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "pax.h"
 #include "extern.h"
@@ -74,6 +77,8 @@ __RCSID("$MirOS: src/bin/pax/ar_io.c,v 1.29 2024/08/17 23:33:50 tg Exp $");
 #define APP_MODE	O_RDWR		/* mode for append */
 #define STDO		"<STDOUT>"	/* pseudo name for stdout */
 #define STDN		"<STDIN>"	/* pseudo name for stdin */
+#define ARRDAHEAD	(256 * MAXBLK)	/* extraction read-ahead window */
+#define ARPIPESZ	(16 * MAXBLK)	/* buffer size asked of pipes */
 int arfd = -1;				/* archive file descriptor */
 static char artyp = ISREG;		/* archive type: file/FIFO/tape */
 static int arvol = 1;			/* archive volume number */
@@ -82,18 +87,83 @@ static char io_ok;			/* i/o worked on volume after resync */
 static char did_io;			/* did i/o ever occur on volume? */
 static char done;			/* set via tty termination */
 static struct stat arsb;		/* stat of archive device at open */
+static off_t arsize;			/* bytes in a file or disc volume */
 static char invld_rec;			/* tape has out of spec record size */
 static char wr_trail = 1;		/* trailer was rewritten in append */
 static char can_unlnk = 0;		/* do we unlink null archives?  */
 const char *arcname;			/* printable name of archive */
 static char *arcname_alloc = NULL;	/* this is so we can free(3) it */
 const char *compress_program;		/* name of compression program */
+int compress_level = -1;		/* its level when writing, if set */
+int compress_threads = -1;		/* its thread count, if set */
+int compress_index = 0;			/* write a gzip seek index */
 static pid_t zpid = -1;			/* pid of child process */
+#if HAVE_POSIX_FADVISE
+static off_t rdahead;			/* read-ahead requested up to here */
+static off_t rdpos = -1;		/* offset of arfd, -1 if not known */
+#endif
+#if HAVE_ZLIB
+static z_stream zs;			/* in-process gzip codec state */
+static char zact;			/* 0 no, 1 read, 2 write, 3 parallel */
+static char zend;			/* read: end of a gzip member seen */
+static char zeof;			/* read: end of compressed input seen */
+static Bytef *zbuf;			/* compressed side of the codec */
+#define ZBUFSZ		MAXBLK
+#define ZCHUNK		(16 * MAXBLK)	/* input per parallel gzip member */
+#define ZWRKMAX		64		/* maximum parallel gzip workers */
+static struct zwrk {
+	pid_t pid;			/* worker process */
+	int tofd;			/* chunks go to the worker here */
+	int fromfd;			/* gzip members come back here */
+	char busy;			/* a member is outstanding */
+} *zwrk;
+static int nzwrk;			/* number of workers running */
+static int zwrknext;			/* worker to get the next chunk */
+static Bytef *zchunk;			/* chunk being filled */
+static size_t zchunklen;		/* bytes in zchunk */
+static size_t zin;			/* write: input to the current member */
+static off_t zout;			/* write: compressed bytes written */
+static off_t zpos;			/* read: decompressed bytes returned */
+static off_t *zidx;			/* seek index: offset of each member */
+static size_t nzidx;			/* entries used in zidx */
+static size_t zidxsz;			/* entries allocated in zidx */
+static char zidxst;			/* read: index 0 unknown, 1 ok, -1 none */
+#define ZIDXMAX		16000		/* members listed per index member */
+#define ZIDXHDR		32		/* index member bytes before sizes */
+#define ZIDXTRL		18		/* index member bytes after sizes */
+#endif
 char force_one_volume;			/* 1 if we ignore volume changes */
 
 #if HAVE_SYS_MTIO_H
 static int get_phys(void);
 #endif
+#if HAVE_POSIX_FADVISE
+static void ar_rdahead(void);
+#endif
+#ifdef F_SETPIPE_SZ
+static void ar_pipebuf(int);
+#else
+#define ar_pipebuf(fd)	/* nothing */
+#endif
+#if HAVE_ZLIB
+static int zlib_start(int);
+static int zlib_read(char *, int);
+static int zlib_write(char *, int);
+static int zlib_flush(void);
+static int zlib_finish(void);
+static void zlib_end(int);
+static int zlib_fow(off_t, off_t *);
+static int zidx_add(off_t);
+static int zidx_write(void);
+static int zidx_load(void);
+static void zle_put(Bytef *, off_t, int);
+static off_t zle_get(const Bytef *, int);
+static int zpar_start(void);
+static void zpar_work(int, int);
+static int zpar_chunk(void);
+static int zpar_collect(struct zwrk *);
+static int zpar_io(int, void *, size_t, int);
+#endif
 extern sigset_t s_mask;
 static void ar_start_compress(int, int);
 
@@ -112,13 +182,18 @@ ar_open(const char *name)
 #if HAVE_SYS_MTIO_H
 	struct mtget mb;
 #endif
+	off_t cpos;
 
 	if (arfd != -1)
 		(void)close(arfd);
 	arfd = -1;
 	can_unlnk = did_io = io_ok = invld_rec = 0;
 	artyp = ISREG;
+	arsize = 0;
 	flcnt = 0;
+#if HAVE_POSIX_FADVISE
+	rdpos = -1;
+#endif
 
 	/*
 	 * open based on overall operation mode
@@ -196,12 +271,30 @@ ar_open(const char *name)
 #else
 		artyp = ISCHR;
 #endif
-	else if (S_ISBLK(arsb.st_mode))
+	else if (S_ISBLK(arsb.st_mode)) {
 		artyp = ISBLK;
-	else if ((lseek(arfd, 0, SEEK_CUR) == -1) && (errno == ESPIPE))
+		/*
+		 * stat does not tell the size of a disc, seeking does
+		 */
+		if (((cpos = lseek(arfd, 0, SEEK_CUR)) < 0) ||
+		    ((arsize = lseek(arfd, 0, SEEK_END)) < 0) ||
+		    (lseek(arfd, cpos, SEEK_SET) < 0))
+			arsize = 0;
+	} else if ((lseek(arfd, 0, SEEK_CUR) == -1) && (errno == ESPIPE)) {
 		artyp = ISPIPE;
-	else
+		ar_pipebuf(arfd);
+	} else {
 		artyp = ISREG;
+		arsize = arsb.st_size;
+	}
+#if HAVE_ZLIB
+	/*
+	 * the in-process codec makes the archive behave as if it came
+	 * through a pipe from an external compressor
+	 */
+	if (zact)
+		artyp = ISPIPE;
+#endif
 
 	/*
 	 * make sure beyond any doubt that we can unlink only regular files
@@ -271,6 +364,16 @@ ar_open(const char *name)
 			blksz = rdblksz;
 		else
 			blksz = MAXBLK;
+#if HAVE_POSIX_FADVISE
+		/*
+		 * disc devices can have many reads in flight, too
+		 */
+		if ((artyp == ISBLK) && (act == EXTRACT)) {
+			(void)posix_fadvise(arfd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			rdahead = 0;
+			ar_rdahead();
+		}
+#endif
 		break;
 	case ISREG:
 		/*
@@ -281,6 +384,16 @@ ar_open(const char *name)
 			blksz = rdblksz = wrblksz;
 			break;
 		}
+#if HAVE_POSIX_FADVISE
+		/*
+		 * while we create files, the kernel can read ahead
+		 */
+		if (act == EXTRACT) {
+			(void)posix_fadvise(arfd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			rdahead = 0;
+			ar_rdahead();
+		}
+#endif
 		/*
 		 * See if we can find the blocking factor from the file size
 		 */
@@ -358,11 +471,16 @@ ar_close(int in_sig)
 	 * for a quick extract/list, pax frequently exits before the child
 	 * process is done
 	 */
-	if ((act == LIST || act == EXTRACT) && nflag && zpid > 0) {
+	if ((act == LIST || act == EXTRACT) && (nflag || idx_done()) &&
+	    zpid > 0) {
 		kill(zpid, SIGINT);
 		zpid = -1;
 	}
 
+#if HAVE_ZLIB
+	if (zact)
+		zlib_end(in_sig);
+#endif
 	(void)close(arfd);
 
 	/* Do not exit before child to ensure data integrity */
@@ -449,6 +567,13 @@ ar_drain(void)
 	 */
 	if ((artyp != ISPIPE) || (lstrval <= 0))
 		return;
+#if HAVE_ZLIB
+	/*
+	 * nobody is waiting on the other side of the in-process codec
+	 */
+	if (zact)
+		return;
+#endif
 
 	/*
 	 * keep reading until pipe is drained
@@ -497,6 +622,77 @@ ar_set_wr(void)
 	return(0);
 }
 
+/*
+ * ar_stream()
+ *	check if the archive is a regular file or a pipe, neither of which
+ *	cares about the size of the reads and writes done on it
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+ar_stream(void)
+{
+	return ((artyp == ISREG) || (artyp == ISPIPE));
+}
+
+/*
+ * ar_seekable()
+ *	check if the archive is a regular file or a disc, in which ar_fow()
+ *	can move to any byte offset and reads may have any size
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+ar_seekable(void)
+{
+	return ((artyp == ISREG) || ((artyp == ISBLK) && (arsize > 0)));
+}
+
+/*
+ * ar_size()
+ *	tell the size of the archive volume when ar_seekable() holds
+ * Return:
+ *	size in bytes
+ */
+
+off_t
+ar_size(void)
+{
+	return (arsize);
+}
+
+/*
+ * ar_pread()
+ *	read from the archive at a given offset when ar_seekable() holds,
+ *	without moving the position ar_read() and ar_fow() work at and
+ *	without going through the archive buffer (the parallel member
+ *	index scan uses this)
+ * Return:
+ *	number of bytes read, 0 at the end of the volume, -1 on error
+ */
+
+ssize_t
+ar_pread(char *buf, size_t cnt, off_t off)
+{
+	ssize_t res;
+	size_t len = 0;
+
+	while (len < cnt) {
+		if ((res = pread(arfd, buf + len, cnt - len,
+		    off + len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		if (res == 0)
+			break;
+		len += res;
+	}
+	return (len);
+}
+
 /*
  * ar_app_ok()
  *	check if the last volume in the archive allows appends. We cannot check
@@ -577,6 +773,15 @@ ar_read(char *buf, int cnt)
 	case ISCHR:
 	case ISPIPE:
 	default:
+#if HAVE_ZLIB
+		if (zact) {
+			if ((res = zlib_read(buf, cnt)) > 0) {
+				io_ok = 1;
+				return(res);
+			}
+			break;
+		}
+#endif
 		/*
 		 * Files are so easy to deal with. These other things cannot
 		 * be trusted at all. So when we are dealing with character
@@ -586,6 +791,13 @@ ar_read(char *buf, int cnt)
 		 */
 		if ((res = read(arfd, buf, cnt)) > 0) {
 			io_ok = 1;
+#if HAVE_POSIX_FADVISE
+			if (rdpos >= 0)
+				rdpos += res;
+			if (((artyp == ISREG) || (artyp == ISBLK)) &&
+			    (act == EXTRACT))
+				ar_rdahead();
+#endif
 			return(res);
 		}
 		break;
@@ -626,7 +838,13 @@ ar_write(char *buf, int bsz)
 	if (lstrval <= 0)
 		return(lstrval);
 
-	if ((res = write(arfd, buf, bsz)) == bsz) {
+#if HAVE_ZLIB
+	if (zact)
+		res = zlib_write(buf, bsz);
+	else
+#endif
+		res = write(arfd, buf, bsz);
+	if (res == bsz) {
 		wr_trail = 1;
 		io_ok = 1;
 		return(bsz);
@@ -788,6 +1006,9 @@ ar_rdsync(void)
 		io_ok = 0;
 		if (((fsbz = arsb.st_blksize) <= 0) || (artyp != ISREG))
 			fsbz = BLKMULT;
+#if HAVE_POSIX_FADVISE
+		rdpos = -1;
+#endif
 		if ((cpos = lseek(arfd, 0, SEEK_CUR)) < 0)
 			break;
 		mpos = fsbz - (cpos % fsbz);
@@ -837,13 +1058,19 @@ ar_fow(off_t sksz, off_t *skipped)
 	if (lstrval <= 0)
 		return(lstrval);
 
+#if HAVE_ZLIB
+	if (zact == 1)
+		return (zlib_fow(sksz, skipped));
+#endif
+
 	/*
 	 * Safer to read forward on devices where it is hard to find the end of
 	 * the media without reading to it. With tapes we cannot be sure of the
 	 * number of physical blocks to skip (we do not know physical block
 	 * size at this point), so we must only read forward on tapes!
+	 * Discs are fine once we know their size.
 	 */
-	if (artyp != ISREG)
+	if (!ar_seekable())
 		return(0);
 
 	/*
@@ -856,19 +1083,130 @@ ar_fow(off_t sksz, off_t *skipped)
 		 * deal with the end of file (it will go to next volume by
 		 * itself)
 		 */
-		if ((mpos = cpos + sksz) > (off_t)arsb.st_size) {
-			*skipped = arsb.st_size - cpos;
-			mpos = arsb.st_size;
+		if ((mpos = cpos + sksz) > arsize) {
+			*skipped = arsize - cpos;
+			mpos = arsize;
 		} else
 			*skipped = sksz;
-		if (lseek(arfd, mpos, SEEK_SET) >= 0)
+		if (lseek(arfd, mpos, SEEK_SET) >= 0) {
+#if HAVE_POSIX_FADVISE
+			rdpos = mpos;
+#endif
 			return(0);
+		}
 	}
 	syswarn(1, errno, "Forward positioning operation on archive failed");
 	lstrval = -1;
 	return(-1);
 }
 
+/*
+ * ar_copy()
+ *	Move up to the specified number of bytes of member data straight from
+ *	the archive to the file ofd, without passing them through the archive
+ *	buffer. This only works on uncompressed archives stored in regular
+ *	files and only when the kernel can copy between the two files; once
+ *	it refuses we never ask again and the caller must use the buffer.
+ *	Both file offsets are advanced by the amount copied.
+ * Return:
+ *	number of bytes copied, which may be short (or 0) at the end of the
+ *	volume or when the kernel cannot do the copy
+ */
+
+off_t
+ar_copy(int ofd, off_t cnt)
+{
+#if HAVE_COPY_FILE_RANGE
+	static char cfr_bad = 0;
+	off_t copied = 0;
+	ssize_t res;
+	size_t len;
+
+	if (cfr_bad || (lstrval <= 0) || (artyp != ISREG) || (zpid != -1))
+		return(0);
+
+	while (copied < cnt) {
+		len = (size_t)MINIMUM(cnt - copied, (off_t)0x40000000L);
+		if ((res = copy_file_range(arfd, NULL, ofd, NULL,
+		    len, 0)) <= 0) {
+			/*
+			 * EOF on the volume, a device that does not
+			 * support this, or a real error: the buffered
+			 * path takes care of reporting
+			 */
+			if (res < 0)
+				cfr_bad = 1;
+			break;
+		}
+		copied += res;
+	}
+	if (copied > 0) {
+		io_ok = 1;
+#if HAVE_POSIX_FADVISE
+		if (rdpos >= 0)
+			rdpos += copied;
+#endif
+	}
+	return(copied);
+#else
+	return(0);
+#endif
+}
+
+#if HAVE_POSIX_FADVISE
+/*
+ * ar_rdahead()
+ *	keep asking the kernel to read ahead of us in a regular file or
+ *	block device archive during extraction, so that the data of the
+ *	next members is on its way while we are busy creating files and
+ *	setting their attributes; the window is large enough to keep deep
+ *	device queues (striped or NVMe storage) busy. The archive offset is
+ *	followed in rdpos by the routines moving it, so it only needs to be
+ *	asked for after a seek they could not follow.
+ */
+
+static void
+ar_rdahead(void)
+{
+	off_t cpos;
+
+	if ((rdpos < 0) && ((rdpos = lseek(arfd, 0, SEEK_CUR)) < 0))
+		return;
+	if ((cpos = rdpos) + ARRDAHEAD / 2 < rdahead)
+		return;
+	/*
+	 * rd_skip() went past the window: only start again when we go
+	 * on reading from there, not for each header of a member we skip
+	 */
+	if (cpos > rdahead + blksz) {
+		rdahead = cpos;
+		return;
+	}
+	if (rdahead < cpos)
+		rdahead = cpos;
+	if ((arsize > 0) && (rdahead >= arsize))
+		return;
+	(void)posix_fadvise(arfd, rdahead, ARRDAHEAD, POSIX_FADV_WILLNEED);
+	rdahead += ARRDAHEAD;
+}
+#endif
+
+#ifdef F_SETPIPE_SZ
+/*
+ * ar_pipebuf()
+ *	enlarge the buffer of a pipe we read the archive from or write it
+ *	to, so the process at the other end (a compressor, or the reader or
+ *	writer of a tape) can go on streaming for a while when we are busy
+ *	with the files; failure just leaves the default size
+ */
+
+static void
+ar_pipebuf(int fd)
+{
+	(void)fcntl(fd, F_SETPIPE_SZ, ARPIPESZ);
+}
+#endif
+
 /*
  * ar_rev()
  *	move the i/o position within the archive backwards the specified byte
@@ -949,6 +1287,9 @@ ar_rev(off_t sksz)
 			lstrval = -1;
 			return(-1);
 		}
+#if HAVE_POSIX_FADVISE
+		rdpos = cpos;
+#endif
 		break;
 #if HAVE_SYS_MTIO_H
 	case ISTAPE:
@@ -1279,14 +1620,42 @@ void
 ar_start_compress(int fd, int wr)
 {
 	int fds[2];
-	const char *compress_flags;
+	const char *zargv[5];
+	char lvlbuf[8];
+	char thrbuf[16];
+	int zargc = 1;
+	int iszstd;
 
 	guess_compress_program(wr);
 	if (compress_program == NULL)
 		return;
+	iszstd = !strcmp(compress_program, "zstd");
+	if (wr && (compress_threads != -1) && !iszstd &&
+	    strcmp(compress_program, "xz") &&
+	    (!HAVE_ZLIB || strcmp(compress_program, "gzip"))) {
+		paxwarn(0, "%s cannot use threads, ignoring %s",
+		    compress_program, "compress.threads");
+		compress_threads = -1;
+	}
+	if (wr && compress_index &&
+	    (!HAVE_ZLIB || strcmp(compress_program, "gzip"))) {
+		paxwarn(0, "%s cannot write a seek index, ignoring %s",
+		    compress_program, "compress.index");
+		compress_index = 0;
+	}
+	if (wr && (compress_level > 9) && !iszstd) {
+		paxwarn(0, "%s cannot use level %d, using %d",
+		    compress_program, compress_level, 9);
+		compress_level = 9;
+	}
+#if HAVE_ZLIB
+	if (!strcmp(compress_program, "gzip") && !zlib_start(wr))
+		return;
+#endif
 
 	if (pipe(fds) < 0)
 		err(1, "pipe");
+	ar_pipebuf(fds[0]);
 	zpid = fork();
 	if (zpid < 0)
 		err(1, "fork");
@@ -1305,24 +1674,766 @@ ar_start_compress(int fd, int wr)
 		}
 #endif
 	} else {
+		/* zstd -q: no progress display on a tty */
 		if (wr) {
 			dup2(fds[0], STDIN_FILENO);
 			dup2(fd, STDOUT_FILENO);
-			compress_flags = "-c";
+			zargv[zargc++] = iszstd ? "-qc" : "-c";
+			if (compress_level != -1) {
+				(void)snprintf(lvlbuf, sizeof(lvlbuf), "-%d",
+				    compress_level);
+				zargv[zargc++] = lvlbuf;
+			}
+			if (compress_threads != -1) {
+				(void)snprintf(thrbuf, sizeof(thrbuf), "-T%d",
+				    compress_threads);
+				zargv[zargc++] = thrbuf;
+			}
 		} else {
 			dup2(fds[1], STDOUT_FILENO);
 			dup2(fd, STDIN_FILENO);
-			compress_flags = "-dc";
+			zargv[zargc++] = iszstd ? "-qdc" : "-dc";
 		}
+		zargv[0] = compress_program;
+		zargv[zargc] = NULL;
 		close(fds[0]);
 		close(fds[1]);
 
 		/* System compressors are more likely to use pledge(2) */
 		putenv("PATH=" PAX_SAFE_PATH);
 
-		if (execlp(compress_program, compress_program,
-		    compress_flags, (char *)NULL) < 0)
+		if (execvp(compress_program, (char * const *)zargv) < 0)
 			err(1, "exec(%s)", compress_program);
 		/* NOTREACHED */
 	}
 }
+
+#if HAVE_ZLIB
+/*
+ * zlib_start()
+ *	set up the in-process gzip codec on arfd instead of running gzip(1)
+ * Return:
+ *	0 if the codec is ready, -1 if the external program must be used
+ */
+
+static int
+zlib_start(int wr)
+{
+	int res;
+
+	if (zact)
+		zlib_end(1);
+	if ((zbuf == NULL) && ((zbuf = malloc(ZBUFSZ)) == NULL))
+		return (-1);
+	zin = 0;
+	zout = zpos = 0;
+	nzidx = 0;
+	zidxst = 0;
+	if (wr && (compress_threads != -1) && (compress_threads != 1) &&
+	    !zpar_start()) {
+		zact = 3;
+		return (0);
+	}
+	memset(&zs, 0, sizeof(zs));
+	if (wr) {
+		res = deflateInit2(&zs, compress_level == -1 ?
+		    Z_DEFAULT_COMPRESSION : compress_level,
+		    Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+		zs.next_out = zbuf;
+		zs.avail_out = ZBUFSZ;
+	} else
+		res = inflateInit2(&zs, 15 + 32);
+	if (res != Z_OK) {
+		paxwarn(0, "Cannot set up %s: %s, running %s", "zlib",
+		    zs.msg ? zs.msg : "unknown error", compress_program);
+		return (-1);
+	}
+	zend = zeof = 0;
+	zact = wr ? 2 : 1;
+	return (0);
+}
+
+/*
+ * zlib_read()
+ *	fill buf with up to cnt bytes of decompressed archive data; like
+ *	gzip -d, members concatenated in the archive are decompressed one
+ *	after the other and anything else following a member is ignored
+ * Return:
+ *	number of bytes in buf, 0 at the end, -1 on error
+ */
+
+static int
+zlib_read(char *buf, int cnt)
+{
+	ssize_t res;
+
+	zs.next_out = (Bytef *)buf;
+	zs.avail_out = cnt;
+	while (!zeof && (zs.avail_out == (uInt)cnt)) {
+		if (zs.avail_in == 0) {
+			if ((res = read(arfd, zbuf, ZBUFSZ)) < 0)
+				return (-1);
+			if (res == 0) {
+				if (!zend)
+					paxwarn(1, "Unexpected end of %s data",
+					    "compressed");
+				zeof = 1;
+				break;
+			}
+			zs.next_in = zbuf;
+			zs.avail_in = (uInt)res;
+		}
+		if (zend) {
+			if (zs.next_in[0] != 0x1F) {
+				/* trailing garbage, e.g. tape padding */
+				zeof = 1;
+				break;
+			}
+			if (inflateReset(&zs) != Z_OK)
+				goto zerr;
+			zend = 0;
+		}
+		switch (inflate(&zs, Z_NO_FLUSH)) {
+		case Z_STREAM_END:
+			zend = 1;
+			break;
+		case Z_OK:
+		case Z_BUF_ERROR:
+			break;
+		default:
+			goto zerr;
+		}
+	}
+	zpos += cnt - zs.avail_out;
+	return (cnt - zs.avail_out);
+
+ zerr:
+	paxwarn(1, "Cannot decompress archive: %s",
+	    zs.msg ? zs.msg : "unknown error");
+	zeof = 1;
+	errno = EIO;
+	return (-1);
+}
+
+/*
+ * zlib_write()
+ *	compress bsz bytes from buf into the archive
+ * Return:
+ *	bsz, or -1 if writing the compressed data failed
+ */
+
+static int
+zlib_write(char *buf, int bsz)
+{
+	size_t cnt, left = bsz;
+
+	if (zact == 3) {
+		while (left) {
+			cnt = ZCHUNK - zchunklen;
+			if (left < cnt)
+				cnt = left;
+			memcpy(zchunk + zchunklen, buf, cnt);
+			zchunklen += cnt;
+			buf += cnt;
+			left -= cnt;
+			if ((zchunklen == ZCHUNK) && (zpar_chunk() < 0))
+				return (-1);
+		}
+		return (bsz);
+	}
+	zs.next_in = (Bytef *)buf;
+	while (left) {
+		cnt = left;
+		if (compress_index) {
+			/* every ZCHUNK input bytes start a new member */
+			if ((zin == 0) &&
+			    (zidx_add(zout + ZBUFSZ - zs.avail_out) < 0))
+				return (-1);
+			if (cnt > ZCHUNK - zin)
+				cnt = ZCHUNK - zin;
+		}
+		zs.avail_in = cnt;
+		while (zs.avail_in) {
+			if (deflate(&zs, Z_NO_FLUSH) == Z_STREAM_ERROR) {
+				errno = EIO;
+				return (-1);
+			}
+			if ((zs.avail_out == 0) && (zlib_flush() < 0))
+				return (-1);
+		}
+		left -= cnt;
+		if (compress_index && ((zin += cnt) == ZCHUNK)) {
+			if ((zlib_finish() < 0) || (deflateReset(&zs) != Z_OK))
+				return (-1);
+			zin = 0;
+		}
+	}
+	return (bsz);
+}
+
+/*
+ * zlib_flush()
+ *	write the compressed data collected so far to the archive
+ * Return:
+ *	0 if ok, -1 on write error
+ */
+
+static int
+zlib_flush(void)
+{
+	size_t cnt = ZBUFSZ - zs.avail_out;
+	ssize_t res;
+	Bytef *pt = zbuf;
+
+	while (cnt) {
+		if ((res = write(arfd, pt, cnt)) <= 0) {
+			if (res == 0)
+				errno = EIO;
+			return (-1);
+		}
+		pt += res;
+		cnt -= res;
+		zout += res;
+	}
+	zs.next_out = zbuf;
+	zs.avail_out = ZBUFSZ;
+	return (0);
+}
+
+/*
+ * zlib_finish()
+ *	end the current gzip member and write out all of it
+ * Return:
+ *	0 if ok, -1 on error
+ */
+
+static int
+zlib_finish(void)
+{
+	int res;
+
+	zs.avail_in = 0;
+	do {
+		if ((res = deflate(&zs, Z_FINISH)) == Z_STREAM_ERROR) {
+			errno = EIO;
+			return (-1);
+		}
+		if (((res == Z_STREAM_END) || (zs.avail_out == 0)) &&
+		    (zlib_flush() < 0))
+			return (-1);
+	} while (res != Z_STREAM_END);
+	return (0);
+}
+
+/*
+ * zlib_end()
+ *	finish the compressed stream (unless called from a signal handler)
+ *	and shut down the in-process codec
+ */
+
+static void
+zlib_end(int in_sig)
+{
+	int res;
+	int i;
+	struct zwrk *w;
+
+	if (zact == 3) {
+		if (!in_sig && (lstrval > 0)) {
+			/* send the last chunk, then collect in order */
+			res = zchunklen ? zpar_chunk() : 0;
+			for (i = 0; (res == 0) && (i < nzwrk); ++i) {
+				w = &zwrk[(zwrknext + i) % nzwrk];
+				if (w->busy)
+					res = zpar_collect(w);
+			}
+			if ((res == 0) && compress_index)
+				res = zidx_write();
+			if (res < 0)
+				syswarn(1, errno,
+				    "Failed write to archive volume: %d",
+				    arvol);
+		}
+		for (i = 0; i < nzwrk; ++i) {
+			(void)close(zwrk[i].tofd);
+			(void)close(zwrk[i].fromfd);
+			waitpid(zwrk[i].pid, &res, 0);
+		}
+		nzwrk = 0;
+		zact = 0;
+		return;
+	}
+	if (zact == 2) {
+		if (!in_sig && (lstrval > 0)) {
+			/* with an index, a full last member is done already */
+			res = (compress_index && (zin == 0)) ? 0 :
+			    zlib_finish();
+			if ((res == 0) && compress_index)
+				res = zidx_write();
+			if (res < 0)
+				syswarn(1, errno,
+				    "Failed write to archive volume: %d",
+				    arvol);
+		}
+		(void)deflateEnd(&zs);
+	} else
+		(void)inflateEnd(&zs);
+	zact = 0;
+}
+
+/*
+ * zlib_fow()
+ *	ar_fow() for the in-process decompressor: if the archive carries a
+ *	seek index (written with compress.index), move straight to the
+ *	member holding the target position instead of decompressing all
+ *	the data in between; the rest is left to the caller to read
+ * Return:
+ *	0 if moved the whole distance, 1 otherwise (see ar_fow)
+ */
+
+static int
+zlib_fow(off_t sksz, off_t *skipped)
+{
+	off_t k;
+
+	if (zidxst == 0)
+		zidxst = zidx_load() < 0 ? -1 : 1;
+	if (zidxst < 0)
+		return (0);
+	if ((k = (zpos + sksz) / ZCHUNK) >= (off_t)nzidx)
+		k = nzidx - 1;
+	if (k <= zpos / ZCHUNK)
+		return (0);
+	if ((lseek(arfd, zidx[k], SEEK_SET) < 0) ||
+	    (inflateReset(&zs) != Z_OK)) {
+		syswarn(1, errno,
+		    "Forward positioning operation on archive failed");
+		lstrval = -1;
+		return (-1);
+	}
+	zs.avail_in = 0;
+	zend = zeof = 0;
+	*skipped = k * ZCHUNK - zpos;
+	zpos = k * ZCHUNK;
+	return (*skipped == sksz ? 0 : 1);
+}
+
+/*
+ * zidx_add()
+ *	note that a new gzip member starts at compressed offset off
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+static int
+zidx_add(off_t off)
+{
+	off_t *p;
+
+	if (nzidx == zidxsz) {
+		if ((p = reallocarray(zidx, zidxsz ? 2 * zidxsz : 1024,
+		    sizeof(off_t))) == NULL)
+			return (-1);
+		zidx = p;
+		zidxsz = zidxsz ? 2 * zidxsz : 1024;
+	}
+	zidx[nzidx++] = off;
+	return (0);
+}
+
+/*
+ * zidx_write()
+ *	append the seek index after the last data member. It is stored in
+ *	the FEXTRA field (subfield "PX") of empty gzip members, which gzip
+ *	-d skips, each listing the compressed size of up to ZIDXMAX data
+ *	members, each of which holds ZCHUNK bytes of archive (the last one
+ *	possibly less). Laid out as:
+ *		gzip header, XLEN, 'P', 'X', subfield length	16 bytes
+ *		offset of the previous index member plus 1	8 bytes
+ *		number of the first data member listed		8 bytes
+ *		compressed size of each data member		4 bytes each
+ *		number of data members listed, "PXIX"		8 bytes
+ *		empty deflate block, CRC32, ISIZE		10 bytes
+ *	all in little endian, so that a reader can find it from the end.
+ * Return:
+ *	0 if ok, -1 on error
+ */
+
+static int
+zidx_write(void)
+{
+	Bytef *buf, *pt;
+	size_t first, n, i;
+	off_t dend = zout, prev = -1;
+
+	if (nzidx == 0)
+		return (0);
+	if ((buf = malloc(ZIDXHDR + 4 * ZIDXMAX + ZIDXTRL)) == NULL)
+		return (-1);
+	for (first = 0; first < nzidx; first += n) {
+		n = nzidx - first;
+		if (n > ZIDXMAX)
+			n = ZIDXMAX;
+		memset(buf, 0, ZIDXHDR);
+		buf[0] = 0x1F;
+		buf[1] = 0x8B;
+		buf[2] = Z_DEFLATED;
+		buf[3] = 0x04;		/* FEXTRA */
+		buf[9] = 0x03;		/* OS: Unix */
+		zle_put(buf + 10, 28 + 4 * n, 2);
+		buf[12] = 'P';
+		buf[13] = 'X';
+		zle_put(buf + 14, 24 + 4 * n, 2);
+		zle_put(buf + 16, prev + 1, 8);
+		zle_put(buf + 24, first, 8);
+		pt = buf + ZIDXHDR;
+		for (i = first; i < first + n; ++i) {
+			zle_put(pt, (i + 1 < nzidx ? zidx[i + 1] : dend) -
+			    zidx[i], 4);
+			pt += 4;
+		}
+		zle_put(pt, n, 4);
+		memcpy(pt + 4, "PXIX\3\0\0\0\0\0\0\0\0\0", ZIDXTRL - 4);
+		if (zpar_io(arfd, buf, ZIDXHDR + 4 * n + ZIDXTRL, 1) < 0) {
+			free(buf);
+			return (-1);
+		}
+		prev = zout;
+		zout += ZIDXHDR + 4 * n + ZIDXTRL;
+	}
+	free(buf);
+	return (0);
+}
+
+/*
+ * zidx_load()
+ *	read the seek index written by zidx_write() from the end of the
+ *	archive, which must be a regular file, into zidx
+ * Return:
+ *	0 if the index is there and consistent, -1 otherwise
+ */
+
+static int
+zidx_load(void)
+{
+	struct stat sb;
+	Bytef tail[ZIDXTRL];
+	Bytef *buf;
+	off_t end, start, prev, first, total = 0, next = 0, want = -1;
+	size_t n, i, len;
+
+	nzidx = 0;
+	if ((fstat(arfd, &sb) < 0) || !S_ISREG(sb.st_mode))
+		return (-1);
+	if ((buf = malloc(ZIDXHDR + 4 * ZIDXMAX + ZIDXTRL)) == NULL)
+		return (-1);
+	end = sb.st_size;
+	for (;;) {
+		if ((end < ZIDXHDR + ZIDXTRL) || (pread(arfd, tail, ZIDXTRL,
+		    end - ZIDXTRL) != ZIDXTRL) || memcmp(tail + 4,
+		    "PXIX\3\0\0\0\0\0\0\0\0\0", ZIDXTRL - 4))
+			goto bad;
+		n = (size_t)zle_get(tail, 4);
+		len = ZIDXHDR + 4 * n + ZIDXTRL;
+		if ((n == 0) || (n > ZIDXMAX) || (end < (off_t)len))
+			goto bad;
+		start = end - len;
+		if ((want != -1) && (start != want))
+			goto bad;
+		if ((pread(arfd, buf, len, start) != (ssize_t)len) ||
+		    (buf[0] != 0x1F) || (buf[1] != 0x8B) ||
+		    (buf[2] != Z_DEFLATED) || (buf[3] != 0x04) ||
+		    (zle_get(buf + 10, 2) != (off_t)(28 + 4 * n)) ||
+		    (buf[12] != 'P') || (buf[13] != 'X') ||
+		    (zle_get(buf + 14, 2) != (off_t)(24 + 4 * n)) ||
+		    ((prev = zle_get(buf + 16, 8)) < 0) ||
+		    ((first = zle_get(buf + 24, 8)) < 0) ||
+		    (first > sb.st_size / ZIDXTRL))
+			goto bad;
+		if (total == 0) {
+			/* the last index member lists the last data member */
+			total = first + n;
+			if ((size_t)total >= zidxsz) {
+				free(zidx);
+				zidxsz = 0;
+				if ((zidx = calloc(total + 1,
+				    sizeof(off_t))) == NULL)
+					goto bad;
+				zidxsz = total + 1;
+			}
+		} else if (first + (off_t)n != next)
+			goto bad;
+		/* sizes go one up, to be summed into offsets below */
+		for (i = 0; i < n; ++i)
+			zidx[first + i + 1] = zle_get(buf + ZIDXHDR + 4 * i,
+			    4);
+		next = first;
+		if (prev == 0)
+			break;
+		/* the earlier index member must end where this one starts */
+		want = prev - 1;
+		end = start;
+	}
+	if (next != 0)
+		goto bad;
+	zidx[0] = 0;
+	for (i = 1; i <= (size_t)total; ++i)
+		zidx[i] += zidx[i - 1];
+	if (zidx[total] != start)
+		goto bad;
+	nzidx = total;
+	free(buf);
+	return (0);
+
+ bad:
+	nzidx = 0;
+	free(buf);
+	return (-1);
+}
+
+/*
+ * zle_put()
+ *	store v as nb byte little endian number at pt
+ */
+
+static void
+zle_put(Bytef *pt, off_t v, int nb)
+{
+	while (nb--) {
+		*pt++ = (Bytef)(v & 0xFF);
+		v >>= 8;
+	}
+}
+
+/*
+ * zle_get()
+ *	fetch an nb byte little endian number from pt
+ * Return:
+ *	the number, or -1 if it does not fit an off_t
+ */
+
+static off_t
+zle_get(const Bytef *pt, int nb)
+{
+	off_t v = 0;
+
+	if ((nb == 8) && (pt[7] & 0x80))
+		return (-1);
+	while (nb--)
+		v = (v << 8) | pt[nb];
+	return (v);
+}
+
+/*
+ * zpar_start()
+ *	fork the workers for writing with compress.threads: every chunk of
+ *	ZCHUNK archive bytes becomes a gzip member of its own, compressed
+ *	in turn by the next worker, so that gzip -d reads the concatenation
+ *	like any other gzip stream
+ * Return:
+ *	0 if at least two workers run, -1 to use the single stream codec
+ */
+
+static int
+zpar_start(void)
+{
+	int n = compress_threads;
+	int i, j;
+	int tofds[2], fromfds[2];
+	pid_t pid;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	if (n == 0)
+		n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (n > ZWRKMAX)
+		n = ZWRKMAX;
+	if (n < 2)
+		return (-1);
+	if ((zwrk == NULL) &&
+	    ((zwrk = calloc(ZWRKMAX, sizeof(struct zwrk))) == NULL))
+		return (-1);
+	if ((zchunk == NULL) && ((zchunk = malloc(ZCHUNK)) == NULL))
+		return (-1);
+
+	for (i = 0; i < n; ++i) {
+		if (pipe(tofds) < 0)
+			break;
+		if (pipe(fromfds) < 0) {
+			(void)close(tofds[0]);
+			(void)close(tofds[1]);
+			break;
+		}
+		if ((pid = fork()) < 0) {
+			(void)close(tofds[0]);
+			(void)close(tofds[1]);
+			(void)close(fromfds[0]);
+			(void)close(fromfds[1]);
+			break;
+		}
+		if (pid == 0) {
+			/* worker: keep only our own pipe ends */
+			(void)close(tofds[1]);
+			(void)close(fromfds[0]);
+			for (j = 0; j < i; ++j) {
+				(void)close(zwrk[j].tofd);
+				(void)close(zwrk[j].fromfd);
+			}
+			(void)close(arfd);
+			zpar_work(tofds[0], fromfds[1]);
+			/* NOTREACHED */
+		}
+		(void)close(tofds[0]);
+		(void)close(fromfds[1]);
+		zwrk[i].pid = pid;
+		zwrk[i].tofd = tofds[1];
+		zwrk[i].fromfd = fromfds[0];
+		zwrk[i].busy = 0;
+	}
+	nzwrk = i;
+	if (nzwrk < 2) {
+		syswarn(0, errno, "Cannot start %s workers, using one",
+		    "compress.threads");
+		while (i--) {
+			(void)close(zwrk[i].tofd);
+			(void)close(zwrk[i].fromfd);
+			waitpid(zwrk[i].pid, &j, 0);
+		}
+		nzwrk = 0;
+		return (-1);
+	}
+	zwrknext = 0;
+	zchunklen = 0;
+	return (0);
+}
+
+/*
+ * zpar_work()
+ *	body of a worker: read length-prefixed chunks from in, write each
+ *	back to out as a length-prefixed complete gzip member; exits at EOF
+ */
+
+static void
+zpar_work(int in, int out)
+{
+	z_stream ws;
+	Bytef *ibuf, *obuf;
+	size_t len;
+	uLong bound;
+
+	(void)signal(SIGHUP, SIG_DFL);
+	(void)signal(SIGINT, SIG_DFL);
+	(void)signal(SIGQUIT, SIG_DFL);
+	(void)signal(SIGTERM, SIG_DFL);
+	(void)signal(SIGXCPU, SIG_DFL);
+	(void)signal(SIGPIPE, SIG_DFL);
+
+	memset(&ws, 0, sizeof(ws));
+	if (deflateInit2(&ws, compress_level == -1 ?
+	    Z_DEFAULT_COMPRESSION : compress_level,
+	    Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		_exit(1);
+	bound = deflateBound(&ws, ZCHUNK);
+	if (((ibuf = malloc(ZCHUNK)) == NULL) ||
+	    ((obuf = malloc(bound)) == NULL))
+		_exit(1);
+
+	while (zpar_io(in, &len, sizeof(len), 0) == 0) {
+		if ((len > ZCHUNK) || (zpar_io(in, ibuf, len, 0) < 0))
+			_exit(1);
+		ws.next_in = ibuf;
+		ws.avail_in = len;
+		ws.next_out = obuf;
+		ws.avail_out = bound;
+		if (deflate(&ws, Z_FINISH) != Z_STREAM_END)
+			_exit(1);
+		len = bound - ws.avail_out;
+		if ((zpar_io(out, &len, sizeof(len), 1) < 0) ||
+		    (zpar_io(out, obuf, len, 1) < 0))
+			_exit(1);
+		if (deflateReset(&ws) != Z_OK)
+			_exit(1);
+	}
+	_exit(0);
+}
+
+/*
+ * zpar_chunk()
+ *	hand the filled chunk to the next worker, first writing out the
+ *	member it still holds from its previous turn
+ * Return:
+ *	0 if ok, -1 on error
+ */
+
+static int
+zpar_chunk(void)
+{
+	struct zwrk *w = &zwrk[zwrknext];
+
+	if (w->busy && (zpar_collect(w) < 0))
+		return (-1);
+	if ((zpar_io(w->tofd, &zchunklen, sizeof(zchunklen), 1) < 0) ||
+	    (zpar_io(w->tofd, zchunk, zchunklen, 1) < 0))
+		return (-1);
+	w->busy = 1;
+	zchunklen = 0;
+	zwrknext = (zwrknext + 1) % nzwrk;
+	return (0);
+}
+
+/*
+ * zpar_collect()
+ *	copy the gzip member outstanding at worker w to the archive
+ * Return:
+ *	0 if ok, -1 on error
+ */
+
+static int
+zpar_collect(struct zwrk *w)
+{
+	size_t len, cnt;
+
+	if (zpar_io(w->fromfd, &len, sizeof(len), 0) < 0)
+		return (-1);
+	if (compress_index && (zidx_add(zout) < 0))
+		return (-1);
+	zout += len;
+	while (len) {
+		cnt = len < ZBUFSZ ? len : ZBUFSZ;
+		if ((zpar_io(w->fromfd, zbuf, cnt, 0) < 0) ||
+		    (zpar_io(arfd, zbuf, cnt, 1) < 0))
+			return (-1);
+		len -= cnt;
+	}
+	w->busy = 0;
+	return (0);
+}
+
+/*
+ * zpar_io()
+ *	read (wr == 0) or write exactly len bytes, retrying short transfers
+ * Return:
+ *	0 if ok, -1 on error or premature EOF
+ */
+
+static int
+zpar_io(int fd, void *buf, size_t len, int wr)
+{
+	char *pt = buf;
+	ssize_t res;
+
+	while (len) {
+		res = wr ? write(fd, pt, len) : read(fd, pt, len);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0) {
+			if (res == 0)
+				errno = EIO;
+			return (-1);
+		}
+		pt += res;
+		len -= res;
+	}
+	return (0);
+}
+#endif
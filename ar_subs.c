@@ -62,6 +62,8 @@
 
 __RCSID("$MirOS: src/bin/pax/ar_subs.c,v 1.20 2018/12/13 07:09:09 tg Exp $");
 
+#define CPRDAHEAD	(16 * MAXBLK)	/* -rw source read-ahead hint size */
+
 static void wr_archive(ARCHD *, int is_app);
 static int get_arc(void);
 static int next_head(ARCHD *);
@@ -88,8 +90,17 @@ list(void)
 	ARCHD *arcn;
 	int res;
 	ARCHD archd;
+	off_t hoff, doff;
+	int scanned;
 
 	arcn = &archd;
+	/*
+	 * a listing into a file or pipe is written out in big blocks,
+	 * ls_list() only flushes each line to a terminal
+	 */
+	if (!isatty(STDOUT_FILENO))
+		(void)setvbuf(stdout, NULL, _IOFBF, LISTBUFSZ);
+
 	/*
 	 * figure out archive type; pass any format specific options to the
 	 * archive option processing routine; call the format init routine. We
@@ -105,11 +116,22 @@ list(void)
 	if (vflag && ((uidtb_start() < 0) || (gidtb_start() < 0)))
 		return;
 #endif
+	if ((idx_rd_start() < 0) || ((scanned = idx_scan()) < 0))
+		return;
 
 	/*
-	 * step through the archive until the format says it is done
+	 * step through the archive until the format says it is done (or
+	 * the member index was made without that); the header offset of a
+	 * member is where its first (e.g. GNU long name) header starts
 	 */
-	while (next_head(arcn) == 0) {
+	hoff = -1;
+	while (!scanned) {
+		if (idx_skip(arcn) != 0)
+			break;
+		if (hoff < 0)
+			hoff = rd_pos();
+		if (next_head(arcn) != 0)
+			break;
 		if (arcn->type == PAX_GLL || arcn->type == PAX_GLF) {
 			/*
 			 * we need to read, to get the real filename
@@ -120,6 +142,7 @@ list(void)
 				(void)rd_skip(cnt + arcn->pad);
 			continue;
 		}
+		doff = rd_pos();
 
 		/*
 		 * check for pattern, and user specified options match.
@@ -136,12 +159,18 @@ list(void)
 				break;
 
 			/*
-			 * modify the name as requested by the user if name
-			 * survives modification, do a listing of the file
+			 * when making a member index, store the file there
+			 * instead. Otherwise, modify the name as requested by
+			 * the user if name survives modification, do a listing
+			 * of the file
 			 */
-			if ((res = mod_name(arcn)) < 0)
+			if (idxscan != NULL)
+				idx_wr_add(arcn, hoff);
+			else if ((res = mod_name(arcn)) < 0)
 				break;
-			if (res == 0)
+			else if ((res == 0) && listjson)
+				ls_json(arcn, stdout, hoff, doff);
+			else if (res == 0)
 				ls_list(arcn, stdout);
 		}
 
@@ -151,6 +180,7 @@ list(void)
 		 */
 		if (rd_skip(arcn->skip + arcn->pad) == 1)
 			break;
+		hoff = -1;
 	}
 
 	/*
@@ -158,7 +188,10 @@ list(void)
 	 * the patterns supplied by the user were all matched
 	 */
 	(void)(*frmt->end_rd)();
+	idx_wr_end();
 	(void)sigprocmask(SIG_BLOCK, &s_mask, NULL);
+	/* the listing goes before the volume summary */
+	(void)fflush(stdout);
 	ar_close(0);
 	pat_chk();
 }
@@ -216,12 +249,14 @@ extract(void)
 	 */
 	if (iflag && (name_start() < 0))
 		return;
+	if (idx_rd_start() < 0)
+		return;
 
 	/*
 	 * step through each entry on the archive until the format read routine
 	 * says it is done
 	 */
-	while (next_head(arcn) == 0) {
+	while ((idx_skip(arcn) == 0) && (next_head(arcn) == 0)) {
 		if (arcn->type == PAX_GLL || arcn->type == PAX_GLF) {
 			/*
 			 * we need to read, to get the real filename
@@ -304,10 +339,13 @@ extract(void)
 		/*
 		 * if required, chdir around.
 		 */
-		if ((arcn->pat != NULL) && (arcn->pat->chdname != NULL))
-			if (!to_stdout && chdir(arcn->pat->chdname) != 0)
+		if ((arcn->pat != NULL) && (arcn->pat->chdname != NULL) &&
+		    !to_stdout) {
+			pdir_flush();
+			if (chdir(arcn->pat->chdname) != 0)
 				syswarn(1, errno, "Cannot chdir to %s",
 				    arcn->pat->chdname);
+		}
 
 		/*
 		 * all ok, extract this member based on type
@@ -367,10 +405,13 @@ extract(void)
 		/*
 		 * if required, chdir around.
 		 */
-		if ((arcn->pat != NULL) && (arcn->pat->chdname != NULL))
-			if (!to_stdout && fchdir(cwdfd) != 0)
+		if ((arcn->pat != NULL) && (arcn->pat->chdname != NULL) &&
+		    !to_stdout) {
+			pdir_flush();
+			if (fchdir(cwdfd) != 0)
 				syswarn(1, errno,
 				    "Cannot fchdir to starting directory");
+		}
 	}
 
 	/*
@@ -399,6 +440,7 @@ wr_archive(ARCHD *arcn, int is_app)
 	int hlk;
 	int wr_one;
 	off_t cnt;
+	off_t hoff;
 	int (*wrf)(ARCHD *);
 	int fd = -1;
 
@@ -433,6 +475,8 @@ wr_archive(ARCHD *arcn, int is_app)
 	 */
 	if (iflag && (name_start() < 0))
 		return;
+	if (idx_wr_start(is_app) < 0)
+		return;
 
 	/*
 	 * while there are files to archive, process them one at at time
@@ -521,10 +565,13 @@ wr_archive(ARCHD *arcn, int is_app)
 		 * looks safe to store the file, have the format specific
 		 * routine write routine store the file header on the archive
 		 */
+		hoff = wr_pos();
 		if ((res = (*wrf)(arcn)) < 0) {
 			rdfile_close(arcn, &fd);
 			break;
 		}
+		if (wr_pos() != hoff)
+			idx_wr_add(arcn, hoff);
 		wr_one = 1;
 		if (res > 0) {
 			/*
@@ -575,6 +622,7 @@ wr_archive(ARCHD *arcn, int is_app)
 		(*frmt->end_wr)();
 		wr_fin();
 	}
+	idx_wr_end();
 	(void)sigprocmask(SIG_BLOCK, &s_mask, NULL);
 	ar_close(0);
 	if (tflag)
@@ -960,6 +1008,16 @@ copy(void)
 			purg_lnk(arcn);
 			continue;
 		}
+#if HAVE_POSIX_FADVISE
+		/*
+		 * get the kernel reading the start of the source while we
+		 * are busy creating the destination
+		 */
+		(void)posix_fadvise(fdsrc, 0, 0, POSIX_FADV_SEQUENTIAL);
+		(void)posix_fadvise(fdsrc, 0,
+		    MINIMUM(arcn->sb.st_size, (off_t)CPRDAHEAD),
+		    POSIX_FADV_WILLNEED);
+#endif
 		if ((fddest = file_creat(arcn)) < 0) {
 			rdfile_close(arcn, &fdsrc);
 			purg_lnk(arcn);
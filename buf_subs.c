@@ -35,6 +35,10 @@
  */
 
 #include <sys/types.h>
+#if HAVE_FICLONE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #include <sys/stat.h>
 #include <errno.h>
 #include <stdio.h>
@@ -56,18 +60,33 @@ __RCSID("$MirOS: src/bin/pax/buf_subs.c,v 1.15 2024/08/17 23:33:50 tg Exp $");
 
 #define MINFBSZ		512		/* default block size for hole detect */
 #define MAXFLT		10		/* default media read error limit */
+#define KEEPMAX		(4 * 1048576)	/* largest file data set_crc() keeps */
+#define RDFEWSZ		4096		/* first read after skipping by seek */
+
+static off_t cp_fast(ARCHD *, int, int, int);
+static void io_start(void);
+static void io_next(void);
 
 /*
  * Need to change bufmem to dynamic allocation when the upper
  * limit on blocking size is removed (though that will violate pax spec)
- * MAXBLK define and tests will also need to be updated.
+ * MAXBLK define and tests will also need to be updated. Only the larger
+ * -o iosize buffer, which is not a record size, is allocated.
  */
 static char bufmem[MAXBLK+BLKMULT];	/* i/o buffer + pushback id space */
 static char *buf;			/* normal start of i/o buffer */
 static char *bufend;			/* end or last char in i/o buffer */
 static char *bufpt;			/* read/write point in i/o buffer */
+static char *iomem;			/* -o iosize buffer + pushback space */
+static char iobig;			/* blksz is the -o iosize, not a record */
+static char *keepmem;			/* file data read by set_crc() */
+static size_t keepsz;			/* allocated size of keepmem */
+static size_t keeplen;			/* bytes of file data in keepmem */
+static int keepfd = -1;			/* file they were read from */
+static int rdfew;			/* read size after a skip, 0 if blksz */
 int blksz = MAXBLK;			/* block input/output size in bytes */
 int wrblksz;				/* user spec output size in bytes */
+int iosize;				/* user spec archive i/o size in bytes */
 int maxflt = MAXFLT;			/* MAX consecutive media errors */
 int rdblksz;				/* first read blksize (tapes only) */
 off_t wrlimit;				/* # of bytes written per archive vol */
@@ -116,8 +135,9 @@ wr_start(void)
 	blksz = rdblksz = wrblksz;
 	if ((ar_open(arcname) < 0) && (ar_next() < 0))
 		return(-1);
+	io_start();
 	wrcnt = 0;
-	bufend = buf + wrblksz;
+	bufend = buf + blksz;
 	bufpt = buf;
 	return(0);
 }
@@ -156,12 +176,63 @@ rd_start(void)
 	 */
 	if ((ar_open(arcname) < 0) && (ar_next() < 0))
 		return(-1);
+	io_start();
 	bufend = buf + rdblksz;
 	bufpt = bufend;
 	rdcnt = 0;
 	return(0);
 }
 
+/*
+ * io_start()
+ *	switch to the larger archive read/write size given with -o iosize,
+ *	if the archive is a regular file or a pipe, where the size of each
+ *	read(2) or write(2) does not matter. When writing, it is a whole
+ *	number of records, and the archive keeps its record blocking. Any
+ *	volume change goes back to the normal sizes, see io_next().
+ */
+
+static void
+io_start(void)
+{
+	int sz;
+
+	if (!iosize || (act == APPND) || (wrlimit > 0) || !ar_stream())
+		return;
+	sz = act == ARCHIVE ? (iosize / blksz) * blksz : iosize;
+	if (sz <= blksz)
+		return;
+	if ((iomem = malloc(sz + BLKMULT)) == NULL) {
+		paxwarn(0, "Unable to allocate %d byte i/o buffer", sz);
+		return;
+	}
+	buf = &(iomem[BLKMULT]);
+	blksz = sz;
+	iobig = 1;
+}
+
+/*
+ * io_next()
+ *	undo io_start() after ar_next() opened another volume and set the
+ *	record size for it. Reading goes back to the normal buffer, which
+ *	is empty then; a write buffer still holds the data not yet written
+ *	and stays, only used by records now.
+ */
+
+static void
+io_next(void)
+{
+	if (!iobig)
+		return;
+	iobig = 0;
+	if (act == ARCHIVE)
+		return;
+	buf = &(bufmem[BLKMULT]);
+	bufpt = bufend = buf;
+	free(iomem);
+	iomem = NULL;
+}
+
 /*
  * cp_start()
  *	set up buffer system for copying within the filesystem
@@ -329,6 +400,7 @@ rd_sync(void)
 			return(-1);
 		else
 			rdcnt = 0;
+		io_next();
 	}
 
 	for (;;) {
@@ -356,12 +428,36 @@ rd_sync(void)
 			continue;
 		if (ar_next() < 0)
 			break;
+		io_next();
 		rdcnt = 0;
 		errcnt = 0;
 	}
 	return(-1);
 }
 
+/*
+ * rd_pos()
+ *	offset in the archive volume of the next byte to be processed
+ *	during an archive read
+ */
+
+off_t
+rd_pos(void)
+{
+	return (rdcnt - (bufend - bufpt));
+}
+
+/*
+ * wr_pos()
+ *	offset in the archive volume of the next byte to be written
+ */
+
+off_t
+wr_pos(void)
+{
+	return (wrcnt + (bufpt - buf));
+}
+
 /*
  * pback()
  *	push the data used during the archive id phase back into the I/O
@@ -418,20 +514,35 @@ rd_skip(off_t skcnt)
 	if (skcnt == 0)
 		return(0);
 
-	/*
-	 * We have to read more, calculate complete and partial record reads
-	 * based on rdblksz. we skip over "cnt" complete records
-	 */
-	res = skcnt%rdblksz;
-	cnt = (skcnt/rdblksz) * rdblksz;
+	if (((act == LIST) || (act == EXTRACT)) && (skcnt >= RDFEWSZ) &&
+	    ar_seekable()) {
+		/*
+		 * in a file or on a disc we can go straight to the next
+		 * header and read only a little from there (see buf_fill()),
+		 * so listing a large archive, or extracting a few members,
+		 * does not read the data of all the others
+		 */
+		if (ar_fow(skcnt, &skipped) < 0)
+			return(-1);
+		res = skcnt - skipped;
+		rdfew = RDFEWSZ;
+	} else {
+		/*
+		 * We have to read more, calculate complete and partial
+		 * record reads based on rdblksz. we skip over "cnt" complete
+		 * records
+		 */
+		res = skcnt%rdblksz;
+		cnt = (skcnt/rdblksz) * rdblksz;
 
-	/*
-	 * if the skip fails, we will have to resync. ar_fow will tell us
-	 * how much it can skip over. We will have to read the rest.
-	 */
-	if (ar_fow(cnt, &skipped) < 0)
-		return(-1);
-	res += cnt - skipped;
+		/*
+		 * if the skip fails, we will have to resync. ar_fow will tell
+		 * us how much it can skip over. We will have to read the rest.
+		 */
+		if (ar_fow(cnt, &skipped) < 0)
+			return(-1);
+		res += cnt - skipped;
+	}
 	rdcnt += skipped;
 
 	/*
@@ -481,6 +592,12 @@ wr_fin(void)
 			bufbt += n;
 		}
 	} else if (bufpt > buf) {
+		if (iobig && (blksz > wrblksz)) {
+			/* only pad out the last record */
+			blksz = ((bufpt - buf + wrblksz - 1) / wrblksz) *
+			    wrblksz;
+			bufend = buf + blksz;
+		}
 		memset(bufpt, 0, bufend - bufpt);
 		bufpt = bufend;
 		(void)buf_flush(blksz);
@@ -631,6 +748,23 @@ wr_rdfile(ARCHD *arcn, int ifd, off_t *left)
 	/*
 	 * while there are more bytes to write
 	 */
+	if ((ifd == keepfd) && (size == (off_t)keeplen)) {
+		/*
+		 * set_crc() has read all of the file already
+		 */
+		keepfd = -1;
+		while (size > 0) {
+			cnt = bufend - bufpt;
+			if ((cnt <= 0) && ((cnt = buf_flush(blksz)) < 0)) {
+				*left = size;
+				return(-1);
+			}
+			cnt = MINIMUM(cnt, size);
+			memcpy(bufpt, keepmem + (keeplen - size), cnt);
+			size -= cnt;
+			bufpt += cnt;
+		}
+	}
 	while (size > 0) {
 		cnt = bufend - bufpt;
 		if ((cnt <= 0) && ((cnt = buf_flush(blksz)) < 0)) {
@@ -661,6 +795,125 @@ wr_rdfile(ARCHD *arcn, int ifd, off_t *left)
 	return(0);
 }
 
+/*
+ * wr_keepbuf()
+ *	get a buffer for set_crc() to read a whole file of up to len bytes
+ *	into, so that wr_rdfile() does not have to read it a second time
+ * Return:
+ *	the buffer, or NULL if the file is too large to keep
+ */
+
+char *
+wr_keepbuf(off_t len)
+{
+	char *np;
+
+	keepfd = -1;
+	if ((len < 0) || (len > KEEPMAX))
+		return (NULL);
+	if ((size_t)len > keepsz) {
+		if ((np = realloc(keepmem, (size_t)len)) == NULL)
+			return (NULL);
+		keepmem = np;
+		keepsz = (size_t)len;
+	}
+	return (keepmem);
+}
+
+/*
+ * wr_kept()
+ *	note that the buffer from wr_keepbuf() holds all len bytes of the
+ *	file open on fd (or, for fd -1, nothing)
+ */
+
+void
+wr_kept(int fd, size_t len)
+{
+	keepfd = fd;
+	keeplen = len;
+}
+
+#ifndef SMALL
+/*
+ * wr_rdextent()
+ *	write size bytes of the file open on ifd, starting at offset off,
+ *	to the archive; used for the data extents of sparse files
+ * Return:
+ *	0, unless archive write failed. left is set to the number of bytes
+ *	that could not be read from the file
+ */
+
+int
+wr_rdextent(ARCHD *arcn, int ifd, off_t off, off_t size, off_t *left)
+{
+	int cnt;
+	int res = 0;
+
+	if (lseek(ifd, off, SEEK_SET) != off) {
+		syswarn(1, errno, "Read fault on %s", arcn->org_name);
+		*left = size;
+		return (0);
+	}
+	while (size > 0) {
+		cnt = bufend - bufpt;
+		if ((cnt <= 0) && ((cnt = buf_flush(blksz)) < 0)) {
+			*left = size;
+			return (-1);
+		}
+		cnt = MINIMUM(cnt, size);
+		if ((res = read(ifd, bufpt, cnt)) <= 0)
+			break;
+		size -= res;
+		bufpt += res;
+	}
+	if (res < 0)
+		syswarn(1, errno, "Read fault on %s", arcn->org_name);
+	else if (size != 0)
+		paxwarn(1, "File changed size during read %s", arcn->org_name);
+	*left = size;
+	return (0);
+}
+
+/*
+ * rd_wrextent()
+ *	extract size bytes of file data from the archive to offset off of
+ *	the file open on ofd; used for the data extents of sparse files
+ * Return:
+ *	0 ok, -1 if archive read failure. if we cannot write all of the
+ *	data we return 0 with left set to the amount not processed
+ */
+
+int
+rd_wrextent(ARCHD *arcn, int ofd, off_t off, off_t size, off_t *left)
+{
+	int cnt;
+	ssize_t res;
+	char *pt;
+
+	*left = size;
+	if (lseek(ofd, off, SEEK_SET) != off) {
+		syswarn(1, errno, "Failed seek on file %s", arcn->name);
+		return (0);
+	}
+	while (size > 0) {
+		if (((cnt = bufend - bufpt) <= 0) &&
+		    ((cnt = buf_fill()) <= 0))
+			return (-1);
+		cnt = MINIMUM(cnt, size);
+		for (pt = bufpt; pt < bufpt + cnt; pt += res)
+			if ((res = write(ofd, pt, bufpt + cnt - pt)) <= 0) {
+				syswarn(1, errno, "Failed write to file %s",
+				    arcn->name);
+				return (0);
+			}
+		bufpt += cnt;
+		size -= cnt;
+		*left = size;
+	}
+	return (0);
+}
+#endif
+
 /*
  * rd_wrfile()
  *	extract the contents of a file from the archive. If we are unable to
@@ -674,8 +927,12 @@ wr_rdfile(ARCHD *arcn, int ifd, off_t *left)
  *	We call a special function to write the file. This function attempts to
  *	restore file holes (blocks of zeros) into the file. When files are
  *	sparse this saves space, and is a LOT faster. For non sparse files
- *	the performance hit is small. As of this writing, no archive supports
- *	information on where the file holes are.
+ *	the performance hit is small. Only ustar archives written with
+ *	write_opt=sparse record where the file holes are (see ustar_rddata).
+ *	With -M nohole, whole records of file data not already in the buffer
+ *	are handed to ar_copy() so that the kernel can move them without a
+ *	trip through our buffer; only the buffered head and tail of the file
+ *	still go through file_write().
  * Return:
  *	0 ok, -1 if archive read failure. if we cannot write the entire file,
  *	we return a 0 but "left" is set to be the amount unwritten
@@ -693,6 +950,7 @@ rd_wrfile(ARCHD *arcn, int ofd, off_t *left)
 	int sz = MINFBSZ;
 	struct stat sb;
 	uint32_t crc = 0;
+	off_t cpcnt;
 
 	/*
 	 * pass the blocksize of the file being written to the write routine,
@@ -710,11 +968,26 @@ rd_wrfile(ARCHD *arcn, int ofd, off_t *left)
 
 	/*
 	 * Copy the archive to the file the number of bytes specified. We have
-	 * to assume that we want to recover file holes as none of the archive
-	 * formats can record the location of file holes.
+	 * to assume that we want to recover file holes as this archive member
+	 * does not record the location of file holes.
 	 */
 	while (size > 0) {
 		cnt = bufend - bufpt;
+		/*
+		 * with the buffer drained, try to have whole records copied
+		 * directly; afterwards resynchronise the hole detection state
+		 * with the new position in the file
+		 */
+		if ((cnt <= 0) && (anonarch & ANON_NOHOLE) && (ofd >= 0) &&
+		    !docrc && (size >= rdblksz) &&
+		    ((cpcnt = ar_copy(ofd, (size / rdblksz) * rdblksz)) > 0)) {
+			rdcnt += cpcnt;
+			size -= cpcnt;
+			isem = 0;
+			if ((rem = (int)((arcn->sb.st_size - size) % sz)) != 0)
+				rem = sz - rem;
+			continue;
+		}
 		/*
 		 * if we get a read error, we do not want to skip, as we may
 		 * miss a header, so we do not set left, but if we get a write
@@ -728,15 +1001,12 @@ rd_wrfile(ARCHD *arcn, int ofd, off_t *left)
 			break;
 		}
 
-		if (docrc) {
-			/*
-			 * update the actual crc value
-			 */
-			cnt = res;
-			while (--cnt >= 0)
-				crc += *bufpt++ & 0xff;
-		} else
-			bufpt += res;
+		/*
+		 * update the actual crc value
+		 */
+		if (docrc)
+			crc = sum_bytes(crc, bufpt, res);
+		bufpt += res;
 		size -= res;
 	}
 
@@ -764,11 +1034,116 @@ rd_wrfile(ARCHD *arcn, int ofd, off_t *left)
 	return(0);
 }
 
+/*
+ * cp_fast()
+ *	let the kernel copy a regular file for us during -rw: first try to
+ *	share the extents of the source (FICLONE), then copy_file_range(2)
+ *	each data region reported by SEEK_DATA/SEEK_HOLE, skipping the holes
+ *	in between. Both files must be positioned at their start and the
+ *	destination must be empty. Whenever the kernel refuses, both file
+ *	offsets are left at the end of what was copied so far.
+ * Return:
+ *	number of bytes copied, 0 when the caller has to do all the work
+ */
+
+static off_t
+cp_fast(ARCHD *arcn, int fd1, int fd2, int no_hole)
+{
+#if HAVE_COPY_FILE_RANGE
+	off_t size = arcn->sb.st_size;
+	off_t pos = 0;
+	off_t dpos;
+	off_t hpos;
+	ssize_t res;
+
+	if (size <= 0)
+		return (0);
+
+#if HAVE_FICLONE
+	if (ioctl(fd2, FICLONE, fd1) == 0) {
+		/*
+		 * the clone covers the whole file as it is now
+		 */
+		if ((pos = lseek(fd2, 0, SEEK_END)) >= 0 &&
+		    lseek(fd1, pos, SEEK_SET) == pos)
+			return (pos);
+		syswarn(1, errno, "Failed seek on file %s", arcn->name);
+		(void)lseek(fd1, 0, SEEK_SET);
+		(void)lseek(fd2, 0, SEEK_SET);
+		(void)ftruncate(fd2, 0);
+		return (0);
+	}
+#endif
+
+	while (pos < size) {
+#if HAVE_SEEK_DATA
+		if ((dpos = lseek(fd1, pos, SEEK_DATA)) < 0) {
+			if (errno != ENXIO)
+				break;
+			/* only a hole is left */
+			dpos = size;
+		}
+		if ((dpos >= size) ||
+		    (hpos = lseek(fd1, dpos, SEEK_HOLE)) < 0 || hpos > size)
+			hpos = size;
+		/*
+		 * a file which takes fewer blocks than its size suggests
+		 * but reports no holes is best left to file_write()
+		 */
+		if (!no_hole && (pos == 0) && (dpos == 0) && (hpos == size))
+			break;
+#else
+		if (!no_hole)
+			break;
+		dpos = pos;
+		hpos = size;
+#endif
+		if (lseek(fd1, dpos, SEEK_SET) != dpos ||
+		    lseek(fd2, dpos, SEEK_SET) != dpos)
+			break;
+		pos = dpos;
+		while (pos < hpos) {
+			if ((res = copy_file_range(fd1, NULL, fd2, NULL,
+			    (size_t)MINIMUM(hpos - pos, (off_t)0x40000000L),
+			    0)) <= 0)
+				goto out;
+			pos += res;
+		}
+	}
+ out:
+	if (pos >= size) {
+		/*
+		 * make the destination as long as the source when it
+		 * ended in a hole, see file_flush()
+		 */
+		if (lseek(fd2, 0, SEEK_END) < size) {
+			if (lseek(fd2, size, SEEK_SET) != size)
+				return (0);
+			file_flush(fd2, arcn->name, 1);
+		}
+		return (size);
+	}
+	/*
+	 * hand over at the last point both files agree on
+	 */
+	if (lseek(fd1, pos, SEEK_SET) != pos ||
+	    lseek(fd2, pos, SEEK_SET) != pos) {
+		(void)lseek(fd1, 0, SEEK_SET);
+		(void)lseek(fd2, 0, SEEK_SET);
+		return (0);
+	}
+	return (pos);
+#else
+	return (0);
+#endif
+}
+
 /*
  * cp_file()
  *	copy the contents of one file to another. used during -rw phase of pax
  *	just as in rd_wrfile() we use a special write function to write the
- *	destination file so we can properly copy files with holes.
+ *	destination file so we can properly copy files with holes. Where the
+ *	kernel can do the copy on its own, cp_fast() gets to try first.
  */
 
 void
@@ -802,6 +1177,15 @@ cp_file(ARCHD *arcn, int fd1, int fd2)
 		syswarn(0,errno,"Unable to obtain block size for file %s",fnm);
 	rem = sz;
 
+	/*
+	 * carry on from wherever the kernel stopped copying
+	 */
+	if ((cpcnt = cp_fast(arcn, fd1, fd2, no_hole)) > 0) {
+		isem = 0;
+		if ((rem = (int)(cpcnt % sz)) != 0)
+			rem = sz - rem;
+	}
+
 	/*
 	 * read the source file and copy to destination file until EOF
 	 */
@@ -854,7 +1238,20 @@ cp_file(ARCHD *arcn, int fd1, int fd2)
 int
 buf_fill(void)
 {
-	return (buf_fill_internal(blksz));
+	int numb = blksz;
+
+	/*
+	 * after rd_skip() moved by seeking, the next header is at the
+	 * start of the buffer; read more only as we go on reading on
+	 */
+	if (rdfew > 0) {
+		if (rdfew < blksz) {
+			numb = rdfew;
+			rdfew *= 2;
+		} else
+			rdfew = 0;
+	}
+	return (buf_fill_internal(numb));
 }
 /*XXX exposure of this breaks block alignment, use only in ar */
 int
@@ -891,6 +1288,12 @@ buf_fill_internal(int numb)
 			return(0);
 		}
 		rdcnt = 0;
+		io_next();
+		/*
+		 * the next volume may be a tape, read whole records
+		 */
+		rdfew = 0;
+		numb = blksz;
 	}
 	exit_val = 1;
 	return(-1);
@@ -995,6 +1398,7 @@ buf_flush(int bufcnt)
 		wrcnt = 0;
 		if (ar_next() < 0)
 			break;
+		io_next();
 
 		/*
 		 * The new archive volume might also have changed the block
@@ -39,7 +39,7 @@
 __RCSID("$MirOS: src/bin/pax/compat.c,v 1.6 2020/09/04 21:09:00 tg Exp $");
 
 int
-binopen3(int features, const char *path, int flags, mode_t mode)
+binopenat(int dfd, int features, const char *path, int flags, mode_t mode)
 {
 	int fd;
 
@@ -57,8 +57,19 @@ binopen3(int features, const char *path, int flags, mode_t mode)
 		flags |= O_DIRECTORY;
 #endif
 
-	if ((fd = (features & BO__TWO) ? open(path, flags) :
-	    open(path, flags, mode)) != -1) {
+	if (dfd == -1)
+		fd = (features & BO__TWO) ? open(path, flags) :
+		    open(path, flags, mode);
+	else {
+#if HAVE_OPENAT
+		fd = (features & BO__TWO) ? openat(dfd, path, flags) :
+		    openat(dfd, path, flags, mode);
+#else
+		errno = ENOSYS;
+		fd = -1;
+#endif
+	}
+	if (fd != -1) {
 #ifdef __OS2__
 		setmode(fd, O_BINARY);
 #endif
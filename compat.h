@@ -181,7 +181,9 @@ typedef unsigned char Wahr;
 #define BO_CLEXEC	0x02	/* set close-on-exec flag or warn */
 #define BO_MAYBE_DIR	0x04	/* add O_DIRECTORY if defined */
 #define binopen2(feat,path,flags) binopen3((feat) | BO__TWO, (path), (flags), 0)
-int binopen3(int, const char *, int, mode_t);
+#define binopen3(feat,path,flags,mode) binopenat(-1, (feat), (path), (flags), (mode))
+/* with a dirfd other than -1, path is relative to it (needs HAVE_OPENAT) */
+int binopenat(int, int, const char *, int, mode_t);
 
 ssize_t dwrite(int, const void *, size_t)
     MKSH_A_BOUNDED(__buffer__, 2, 3);
@@ -64,16 +64,24 @@ int uar_trail(ARCHD *, char *, int, int *) MKSH_A_NORETURN;
  */
 extern const char *arcname;
 extern const char *compress_program;
+extern int compress_level;
+extern int compress_threads;
+extern int compress_index;
 extern char force_one_volume;
 int ar_open(const char *);
 void ar_close(int _in_sig);
 void ar_drain(void);
 int ar_set_wr(void);
 int ar_app_ok(void);
+int ar_stream(void);
+int ar_seekable(void);
+off_t ar_size(void);
+ssize_t ar_pread(char *, size_t, off_t);
 int ar_read(char *, int);
 int ar_write(char *, int);
 int ar_rdsync(void);
 int ar_fow(off_t, off_t *);
+off_t ar_copy(int, off_t);
 int ar_rev(off_t );
 int ar_next(void);
 extern char ar_do_keepopen;
@@ -94,6 +102,7 @@ void copy(void);
  */
 extern int blksz;
 extern int wrblksz;
+extern int iosize;
 extern int maxflt;
 extern int rdblksz;
 extern off_t wrlimit;
@@ -104,6 +113,8 @@ int rd_start(void);
 void cp_start(void);
 int appnd_start(off_t);
 int rd_sync(void);
+off_t rd_pos(void);
+off_t wr_pos(void);
 void pback(const char *, int);
 int rd_skip(off_t);
 void wr_fin(void);
@@ -111,7 +122,13 @@ int wr_rdbuf(const char *, int);
 int rd_wrbuf(char *, int);
 int wr_skip(off_t);
 int wr_rdfile(ARCHD *, int, off_t *);
+char *wr_keepbuf(off_t);
+void wr_kept(int, size_t);
 int rd_wrfile(ARCHD *, int, off_t *);
+#ifndef SMALL
+int wr_rdextent(ARCHD *, int, off_t, off_t, off_t *);
+int rd_wrextent(ARCHD *, int, off_t, off_t, off_t *);
+#endif
 void cp_file(ARCHD *, int, int);
 int buf_fill(void);
 int buf_fill_internal(int);
@@ -192,6 +209,7 @@ int file_write(int, char *, int, int *, int *, int, char *);
 void file_flush(int, char *, int);
 void rdfile_close(ARCHD *, int *);
 int set_crc(ARCHD *, int);
+void pdir_flush(void);
 
 /*
  * ftree.c
@@ -206,7 +224,9 @@ int next_file(ARCHD *);
 /*
  * gen_subs.c
  */
+extern char listjson;
 void ls_list(ARCHD *, FILE *);
+void ls_json(ARCHD *, FILE *, off_t, off_t);
 void ls_tty(ARCHD *);
 void safe_print(const char *, FILE *);
 u_long asc_ul(char *, int, int);
@@ -214,6 +234,7 @@ int ul_asc(u_long, char *, int, int);
 unsigned long long asc_ull(char *, int, int);
 int ull_asc(unsigned long long, char *, int, int);
 size_t fieldcpy(char *, size_t, const char *, size_t);
+uint32_t sum_bytes(uint32_t, const char *, size_t);
 
 /*
  * getoldopt.c
@@ -244,6 +265,9 @@ int pat_add(char *, char *);
 void pat_chk(void);
 int pat_sel(ARCHD *);
 int pat_match(ARCHD *);
+int pat_lit(void);
+int pat_none(void);
+int pat_cand(const char *, size_t);
 int mod_name(ARCHD *);
 int set_dest(ARCHD *, char *, int);
 int has_dotdot(const char *);
@@ -296,6 +320,7 @@ void sig_cleanup(int) MKSH_A_NORETURN;
  * sel_subs.c
  */
 int sel_chk(ARCHD *);
+int sel_none(void);
 int grp_add(char *);
 int usr_add(char *);
 int trng_add(char *);
@@ -330,12 +355,23 @@ void proc_dir(int _in_sig);
 unsigned int st_hash(const char *, int, int);
 int flnk_start(void);
 int chk_flnk(ARCHD *);
+extern const char *idxname;
+extern const char *idxscan;
+extern int idxthreads;
+int idx_wr_start(int);
+void idx_wr_add(ARCHD *, off_t);
+void idx_wr_end(void);
+int idx_rd_start(void);
+int idx_skip(ARCHD *);
+int idx_done(void);
+int idx_scan(void);
 
 /*
  * tar.c
  */
 #ifndef SMALL
 extern char tar_nodir;
+extern char tar_sparse;
 #endif
 extern char *gnu_name_string, *gnu_link_string;
 int tar_endwr(void);
@@ -352,8 +388,16 @@ int tar_wr(ARCHD *);
 int ustar_strd(void);
 int ustar_stwr(int);
 int ustar_id(char *, int);
+off_t ustar_hdinfo(off_t, IDXHD *);
 int ustar_rd(ARCHD *, char *);
 int ustar_wr(ARCHD *);
+#ifndef SMALL
+int ustar_rddata(ARCHD *, int, off_t *);
+int ustar_wrdata(ARCHD *, int, off_t *);
+#else
+#define ustar_rddata rd_wrfile
+#define ustar_wrdata wr_rdfile
+#endif
 
 /*
  * tty_subs.c
@@ -83,10 +83,155 @@ __RCSID("$MirOS: src/bin/pax/file_subs.c,v 1.34 2025/07/27 23:02:46 tg Exp $");
 #endif
 
 static int mk_link(char *, struct stat *, char *, int);
+static int iszero(const char *, int);
 #ifdef PAX_FSET_FTIME
 static void fset_ftime(const char *, int, const struct stat *, int);
 #endif
 
+#if HAVE_OPENAT
+/*
+ * Cache of descriptors of the parent directories of the names we create,
+ * so that with the *at() calls the kernel need not walk all the leading
+ * path components again on each of the several syscalls made for every
+ * extracted file. Entries are keyed by the parent path as it appears in
+ * the name and are dropped whenever a directory or symlink (which could
+ * be one of the parents) is removed, or the current directory changes.
+ */
+#define PDIR_CNT	8		/* parent directories kept open */
+
+static struct pdir {
+	char		*path;		/* parent path, with trailing slash */
+	size_t		len;		/* length of path */
+	int		fd;		/* descriptor of the directory */
+	unsigned int	used;		/* clock of the last use, for LRU */
+} pdirs[PDIR_CNT];
+static unsigned int pdirclk;
+
+static int pdir_get(const char *, const char **);
+
+#define pdir_at			pdir_get
+#define at_lstat(d,p,sb)	fstatat((d), (p), (sb), AT_SYMLINK_NOFOLLOW)
+#define at_access(d,p,m)	faccessat((d), (p), (m), 0)
+#define at_mkdir(d,p,m)		mkdirat((d), (p), (m))
+#define at_mknod(d,p,m,r)	mknodat((d), (p), (m), (r))
+#define at_mkfifo(d,p,m)	mkfifoat((d), (p), (m))
+#define at_symlink(t,d,p)	symlinkat((t), (d), (p))
+#define at_rmdir(d,p)		unlinkat((d), (p), AT_REMOVEDIR)
+#define at_unlink(d,p)		unlinkat((d), (p), 0)
+#else
+/* names are used as they are, relative to the current directory */
+#define pdir_get(nm,bp)		(*(bp) = (nm), -1)
+#define pdir_at(nm,bp)		(*(bp) = (nm), AT_FDCWD)
+#define at_lstat(d,p,sb)	((void)(d), lstat((p), (sb)))
+#define at_access(d,p,m)	((void)(d), access((p), (m)))
+#define at_mkdir(d,p,m)		((void)(d), mkdir((p), (m)))
+#define at_mknod(d,p,m,r)	((void)(d), mknod((p), (m), (r)))
+#define at_mkfifo(d,p,m)	((void)(d), mkfifo((p), (m)))
+#define at_symlink(t,d,p)	((void)(d), symlink((t), (p)))
+#define at_rmdir(d,p)		((void)(d), rmdir(p))
+#define at_unlink(d,p)		((void)(d), unlink(p))
+#endif
+
+/* a removed node might have been a cached parent directory */
+#define pdir_gone(sbp) do {						\
+	if (S_ISDIR((sbp)->st_mode) || S_ISLNK((sbp)->st_mode))	\
+		pdir_flush();						\
+} while (/* CONSTCOND */ 0)
+
+#if HAVE_OPENAT
+/*
+ * pdir_get()
+ *	look up (or open and cache) the parent directory of name, setting
+ *	base to the last component of name
+ * Return:
+ *	descriptor of the parent directory; AT_FDCWD (with base set to
+ *	name) if name has no parent or it cannot be opened
+ */
+
+static int
+pdir_get(const char *name, const char **base)
+{
+	const char *cp, *end;
+	struct pdir *pd, *lru;
+	size_t len;
+	char *path;
+	int fd;
+
+	*base = name;
+	/* find the last component, ignoring trailing slashes */
+	end = name + strlen(name);
+	while ((end > name + 1) && (end[-1] == '/'))
+		--end;
+	for (cp = end; (cp > name) && (cp[-1] != '/'); --cp)
+		/* nothing */;
+	if ((cp == name) || (cp == end))
+		return (AT_FDCWD);
+	len = cp - name;
+
+	lru = &pdirs[0];
+	for (pd = &pdirs[0]; pd < &pdirs[PDIR_CNT]; ++pd) {
+		if ((pd->path != NULL) && (pd->len == len) &&
+		    !memcmp(pd->path, name, len)) {
+			pd->used = ++pdirclk;
+			*base = cp;
+			return (pd->fd);
+		}
+		if ((lru->path != NULL) &&
+		    ((pd->path == NULL) || (pd->used < lru->used)))
+			lru = pd;
+	}
+
+	/*
+	 * not cached; on failure, leave it to the caller to find out
+	 * what is wrong using the full name
+	 */
+	if ((path = malloc(len + 1)) == NULL)
+		return (AT_FDCWD);
+	memcpy(path, name, len);
+	path[len] = '\0';
+	if ((fd = binopen2(BO_CLEXEC | BO_MAYBE_DIR, path,
+#ifdef O_PATH
+	    O_PATH
+#else
+	    O_RDONLY
+#endif
+	    )) < 0) {
+		free(path);
+		return (AT_FDCWD);
+	}
+	if (lru->path != NULL) {
+		(void)close(lru->fd);
+		free(lru->path);
+	}
+	lru->path = path;
+	lru->len = len;
+	lru->fd = fd;
+	lru->used = ++pdirclk;
+	*base = cp;
+	return (fd);
+}
+#endif
+
+/*
+ * pdir_flush()
+ *	close all cached parent directory descriptors
+ */
+
+void
+pdir_flush(void)
+{
+#if HAVE_OPENAT
+	struct pdir *pd;
+
+	for (pd = &pdirs[0]; pd < &pdirs[PDIR_CNT]; ++pd)
+		if (pd->path != NULL) {
+			(void)close(pd->fd);
+			free(pd->path);
+			pd->path = NULL;
+		}
+#endif
+}
+
 /*
  * file_creat()
  *	Create and open a file.
@@ -100,6 +245,8 @@ file_creat(ARCHD *arcn)
 	int fd = -1;
 	mode_t file_mode;
 	int oerrno;
+	int dfd;
+	const char *base;
 
 	/*
 	 * Assume file doesn't exist, so just try to create it, most times this
@@ -113,7 +260,8 @@ file_creat(ARCHD *arcn)
 	 * first with lstat.
 	 */
 	file_mode = arcn->sb.st_mode & FILEBITS;
-	if ((fd = binopen3(0, arcn->name, O_WRONLY | O_CREAT | O_EXCL,
+	dfd = pdir_get(arcn->name, &base);
+	if ((fd = binopenat(dfd, 0, base, O_WRONLY | O_CREAT | O_EXCL,
 	    file_mode)) >= 0)
 		return (fd);
 
@@ -131,7 +279,8 @@ file_creat(ARCHD *arcn)
 		 * the path and give it a final try. if chk_path() finds that
 		 * it cannot fix anything, we will skip the last attempt
 		 */
-		if ((fd = binopen3(0, arcn->name, O_WRONLY | O_CREAT | O_TRUNC,
+		dfd = pdir_get(arcn->name, &base);
+		if ((fd = binopenat(dfd, 0, base, O_WRONLY | O_CREAT | O_TRUNC,
 		    file_mode)) >= 0)
 			break;
 		oerrno = errno;
@@ -370,6 +519,7 @@ mk_link(char *to, struct stat *to_sb, char *from, int ign)
 			}
 			return(1);
 		}
+		pdir_gone(&sb);
 	}
 
 	/*
@@ -459,6 +609,8 @@ node_creat(ARCHD *arcn)
 	char *allocd = NULL;
 	char *nm = arcn->name;
 	int len, defer_pmode = 0;
+	int dfd;
+	const char *base;
 
 	/*
 	 * create node based on type, if that fails try to unlink the node and
@@ -469,6 +621,7 @@ node_creat(ARCHD *arcn)
 	file_mode = arcn->sb.st_mode & FILEBITS;
 
 	for (;;) {
+		dfd = pdir_get(nm, &base);
 		switch (arcn->type) {
 		case PAX_DIR:
 			/*
@@ -501,8 +654,9 @@ node_creat(ARCHD *arcn)
 					free(allocd);
 					allocd = target;
 				}
+				dfd = pdir_get(nm, &base);
 			}
-			res = mkdir(nm, file_mode);
+			res = at_mkdir(dfd, base, file_mode);
 
  badlink:
 			if (ign)
@@ -510,14 +664,14 @@ node_creat(ARCHD *arcn)
 			break;
 		case PAX_CHR:
 			file_mode |= S_IFCHR;
-			res = mknod(nm, file_mode, arcn->sb.st_rdev);
+			res = at_mknod(dfd, base, file_mode, arcn->sb.st_rdev);
 			break;
 		case PAX_BLK:
 			file_mode |= S_IFBLK;
-			res = mknod(nm, file_mode, arcn->sb.st_rdev);
+			res = at_mknod(dfd, base, file_mode, arcn->sb.st_rdev);
 			break;
 		case PAX_FIF:
-			res = mkfifo(nm, file_mode);
+			res = at_mkfifo(dfd, base, file_mode);
 			break;
 		case PAX_SCK:
 			/*
@@ -531,7 +685,7 @@ node_creat(ARCHD *arcn)
 		case PAX_SLK:
 			if (arcn->ln_name[0] != '/' &&
 			    !has_dotdot(arcn->ln_name))
-				res = symlink(arcn->ln_name, nm);
+				res = at_symlink(arcn->ln_name, dfd, base);
 			else {
 				/*
 				 * absolute symlinks and symlinks with ".."
@@ -616,9 +770,9 @@ node_creat(ARCHD *arcn)
 		 * before pax exits.  To do that safely, we want the dev+ino
 		 * of the directory we created.
 		 */
-		if (lstat(nm, &sb) < 0) {
+		if (at_lstat(dfd, base, &sb) < 0) {
 			syswarn(0, errno, "Unable to stat %s", nm);
-		} else if (access(nm, R_OK | W_OK | X_OK) < 0) {
+		} else if (at_access(dfd, base, R_OK | W_OK | X_OK) < 0) {
 			/*
 			 * We have to add rights to the dir, so we make
 			 * sure to restore the mode. The mode must be
@@ -665,11 +819,14 @@ int
 unlnk_exist(char *name, int type)
 {
 	struct stat sb;
+	int dfd;
+	const char *base;
 
 	/*
 	 * the file does not exist, or -k we are done
 	 */
-	if (lstat(name, &sb) < 0)
+	dfd = pdir_get(name, &base);
+	if (at_lstat(dfd, base, &sb) < 0)
 		return(0);
 	if (kflag)
 		return(-1);
@@ -679,23 +836,25 @@ unlnk_exist(char *name, int type)
 		 * try to remove a directory, if it fails and we were going to
 		 * create a directory anyway, tell the caller (return a 1)
 		 */
-		if (rmdir(name) < 0) {
+		if (at_rmdir(dfd, base) < 0) {
 			if (type == PAX_DIR)
 				return(1);
 			syswarn(1,errno,"Unable to remove directory %s", name);
 			return(-1);
 		}
 		delete_dir(sb.st_dev, sb.st_ino);
+		pdir_gone(&sb);
 		return(0);
 	}
 
 	/*
 	 * try to get rid of all non-directory type nodes
 	 */
-	if (unlink(name) < 0) {
+	if (at_unlink(dfd, base) < 0) {
 		syswarn(1, errno, "Unable to remove %s", name);
 		return(-1);
 	}
+	pdir_gone(&sb);
 	return(0);
 }
 
@@ -817,6 +976,8 @@ set_ftime(const char *fnm, const struct stat *sbp, int frc,
 {
 #if HAVE_UTIMENSAT
 	struct timespec ts[2];
+	const char *base;
+	int dfd;
 #else
 	struct {
 		time_t tv_sec;
@@ -859,7 +1020,8 @@ set_ftime(const char *fnm, const struct stat *sbp, int frc,
 
 	/* set the times */
 #if HAVE_UTIMENSAT
-	rv = utimensat(AT_FDCWD, fnm, ts, AT_SYMLINK_NOFOLLOW);
+	dfd = pdir_at(fnm, &base);
+	rv = utimensat(dfd, base, ts, AT_SYMLINK_NOFOLLOW);
 #elif HAVE_UTIMES
 	tv[0].tv_sec = ts[0].tv_sec;
 	tv[0].tv_usec = ts[0].tv_nsec / 1000;
@@ -959,9 +1121,12 @@ int
 set_ids(char *fnm, uid_t uid, gid_t gid, int issymlink MKSH_A_UNUSED)
 {
 	int rv;
-
 #if HAVE_FCHOWNAT
-	rv = fchownat(AT_FDCWD, fnm, uid, gid, AT_SYMLINK_NOFOLLOW);
+	const char *base;
+	int dfd;
+
+	dfd = pdir_at(fnm, &base);
+	rv = fchownat(dfd, base, uid, gid, AT_SYMLINK_NOFOLLOW);
 #elif HAVE_LCHOWN
 	rv = (issymlink ? lchown : chown)(fnm, uid, gid);
 	if (rv < 0 && issymlink && (errno == ENOSYS || errno == ENOTSUP))
@@ -1020,10 +1185,15 @@ void
 set_pmode(char *fnm, mode_t mode, int issymlink MKSH_A_UNUSED)
 {
 	int rv;
+#if HAVE_FCHMODAT
+	const char *base;
+	int dfd;
+#endif
 
 	mode &= ABITS;
 #if HAVE_FCHMODAT
-	rv = fchmodat(AT_FDCWD, fnm, mode, AT_SYMLINK_NOFOLLOW);
+	dfd = pdir_at(fnm, &base);
+	rv = fchmodat(dfd, base, mode, AT_SYMLINK_NOFOLLOW);
 	if (rv < 0 && (errno == ENOSYS || errno == ENOTSUP)) {
 		/* glibc sucks */
 		if (issymlink)
@@ -1073,7 +1243,7 @@ set_attr(const struct file_times *ft, int force_times, mode_t mode,
 	 * so do *not* use O_NOFOLLOW.  The dev+ino check will
 	 * protect us from evil.
 	 */
-	fd = binopen2(BO_MAYBE_DIR, ft->ft_name, O_RDONLY);
+	fd = binopenat(ft->ft_dirfd, BO_MAYBE_DIR, ft->ft_name, O_RDONLY, 0);
 	if (fd == -1) {
 		if (!in_sig)
 			syswarn(1, errno, "Unable to restore mode and times"
@@ -1153,6 +1323,7 @@ set_attr(const struct file_times *ft, int force_times, mode_t mode,
  *	the end. In this case we drop a single 0 at the end to force the
  *	trailing 0's in the file.
  *	---Parameters---
+ *	Consecutive blocks with data are written out in one go.
  *	rem: how many bytes left in this filesystem block
  *	isempt: have we written to the file block yet (is it empty)
  *	sz: basic file block allocation size
@@ -1166,9 +1337,8 @@ int
 file_write(int fd, char *str, int cnt, int *rem, int *isempt, int sz,
 	char *name)
 {
-	char *pt;
-	char *end;
 	int wcnt;
+	int wlen = 0;
 	char *st = str;
 	char **strp;
 
@@ -1198,19 +1368,14 @@ file_write(int fd, char *str, int cnt, int *rem, int *isempt, int sz,
 			 * have not written to this block yet, so we keep
 			 * looking for zero's
 			 */
-			pt = st;
-			end = st + wcnt;
-
-			/*
-			 * look for a zero filled buffer
-			 */
-			while ((pt < end) && (*pt == '\0'))
-				++pt;
-
-			if (pt == end) {
+			if (iszero(st, wcnt)) {
 				/*
-				 * skip, buf is empty so far
+				 * skip, buf is empty so far; the data
+				 * before it must be written out first
 				 */
+				if (wlen && (write(fd, st - wlen, wlen) != wlen))
+					goto wrfail;
+				wlen = 0;
 				if (fd > -1 &&
 				    lseek(fd, wcnt, SEEK_CUR) < 0) {
 					if (errno == ESPIPE)
@@ -1219,7 +1384,7 @@ file_write(int fd, char *str, int cnt, int *rem, int *isempt, int sz,
 					    "Failed seek on file %s", name);
 					return (-1);
 				}
-				st = pt;
+				st += wcnt;
 				continue;
 			}
  isapipe:
@@ -1254,13 +1419,34 @@ file_write(int fd, char *str, int cnt, int *rem, int *isempt, int sz,
 			memcpy(*strp, st, wcnt);
 			(*strp)[wcnt] = '\0';
 			break;
-		} else if (write(fd, st, wcnt) != wcnt) {
-			syswarn(1, errno, "Failed write to file %s", name);
-			return(-1);
 		}
+		/* written later, with any blocks with data that follow */
+		wlen += wcnt;
 		st += wcnt;
 	}
+	if (wlen && (write(fd, st - wlen, wlen) != wlen))
+		goto wrfail;
 	return(st - str);
+
+ wrfail:
+	syswarn(1, errno, "Failed write to file %s", name);
+	return(-1);
+}
+
+/*
+ * iszero()
+ *	check if a buffer is all zero bytes: the first one is, and each
+ *	is equal to the next. This lets memcmp(3), which the C library
+ *	typically does many bytes at a time, do the scanning.
+ * Return:
+ *	1 if all len bytes are zero, 0 otherwise
+ */
+
+static int
+iszero(const char *pt, int len)
+{
+	return ((len <= 0) ||
+	    ((*pt == '\0') && !memcmp(pt, pt + 1, len - 1)));
 }
 
 /*
@@ -1333,12 +1519,12 @@ rdfile_close(ARCHD *arcn MKSH_A_UNUSED, int *fd)
 int
 set_crc(ARCHD *arcn, int fd)
 {
-	int i;
 	int res;
 	off_t cpcnt = 0;
 	size_t size;
 	uint32_t crc = 0;
 	char tbuf[FILEBLK];
+	char *kbuf = NULL;
 	struct stat sb;
 
 	if (fd < 0) {
@@ -1349,19 +1535,26 @@ set_crc(ARCHD *arcn, int fd)
 		return(0);
 	}
 
-	if ((size = arcn->sb.st_blksize) > sizeof(tbuf))
-		size = sizeof(tbuf);
-
 	/*
 	 * read all the bytes we think that there are in the file. If the user
-	 * is trying to archive an active file, forget this file.
+	 * is trying to archive an active file, forget this file. A file that
+	 * is not too large is read into memory in one go and handed over to
+	 * wr_rdfile(), which then need not read it again; one byte more is
+	 * asked for to see whether it grew.
 	 */
-	for (;;) {
-		if ((res = read(fd, tbuf, size)) <= 0)
-			break;
-		cpcnt += res;
-		for (i = 0; i < res; ++i)
-			crc += (tbuf[i] & 0xff);
+	if ((kbuf = wr_keepbuf(arcn->sb.st_size + 1)) != NULL) {
+		while ((cpcnt <= arcn->sb.st_size) &&
+		    ((res = read(fd, kbuf + cpcnt,
+		    (size_t)(arcn->sb.st_size + 1 - cpcnt))) > 0))
+			cpcnt += res;
+		crc = sum_bytes(crc, kbuf, (size_t)cpcnt);
+	} else {
+		if ((size = arcn->sb.st_blksize) > sizeof(tbuf))
+			size = sizeof(tbuf);
+		while ((res = read(fd, tbuf, size)) > 0) {
+			cpcnt += res;
+			crc = sum_bytes(crc, tbuf, res);
+		}
 	}
 
 	/*
@@ -1374,9 +1567,11 @@ set_crc(ARCHD *arcn, int fd)
 		syswarn(1, errno, "Failed stat on %s", arcn->org_name);
 	else if (st_timecmp(m, &arcn->sb, &sb, !=))
 		paxwarn(1, "File %s was modified during read", arcn->org_name);
-	else if (lseek(fd, 0, SEEK_SET) < 0)
+	else if ((kbuf == NULL) && (lseek(fd, 0, SEEK_SET) < 0))
 		syswarn(1, errno, "File rewind failed on: %s", arcn->org_name);
 	else {
+		if (kbuf != NULL)
+			wr_kept(fd, (size_t)cpcnt);
 		arcn->crc = crc;
 		return(0);
 	}
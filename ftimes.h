@@ -41,10 +41,12 @@ __IDSTRING(rcsid_ftimes_h, "$MirOS: src/bin/pax/ftimes.h,v 1.2 2018/12/12 18:08:
  * Time data for a given file.  This is usually embedded in a structure
  * indexed by dev+ino, by name, by order in the archive, etc.  set_attr()
  * takes one of these and will only change the times or mode if the file
- * at the given name has the indicated dev+ino.
+ * at the given name (looked up relative to ft_dirfd unless that is -1)
+ * has the indicated dev+ino.
  */
 struct file_times {
 	char	*ft_name;		/* name of file to set the times on */
+	int	ft_dirfd;		/* directory ft_name is relative to, or -1 */
 	ino_t	ft_ino;			/* inode number to verify */
 	dev_t	ft_dev;			/* device number to verify */
 	struct stat sb;			/* times to set (atime, mtime) */
@@ -84,8 +84,28 @@ __RCSID("$MirOS: src/bin/pax/gen_subs.c,v 1.22 2021/09/23 21:15:49 tg Exp $");
 #define CURFRMT		"%b %e %H:%M"
 #define OLDFRMT		"%b %e  %Y"
 #define NAME_WIDTH	8
-#define	TIMEFMT(t) \
-	(((t) + SIXMONTHS <= now || (t) > now) ? OLDFRMT : CURFRMT)
+#define	ISCURTIME(t)	((t) + SIXMONTHS > now && (t) <= now)
+#define	TIMEFMT(t)	(ISCURTIME(t) ? CURFRMT : OLDFRMT)
+#define DATECACHE	64	/* formatted dates remembered */
+
+/*
+ * ls_date() cache: a date string is valid for a range of times, the
+ * minute or (without the time of day) the day it shows
+ */
+static struct datec {
+	time_t lo;		/* first time it is valid for */
+	time_t hi;		/* first time after that it is not */
+	char cur;		/* made with CURFRMT (else OLDFRMT) */
+	char date[DATELEN];	/* the formatted date */
+} datec[DATECACHE];
+
+char listjson;				/* list members as JSON objects */
+
+static const char *ls_date(time_t);
+static void json_name(const char *, const char *, FILE *);
+static int utf8_ok(const unsigned char *);
+static int ls_sameday(time_t, const struct tm *);
+static int fp_isatty(FILE *);
 
 /*
  * ls_list()
@@ -97,7 +117,6 @@ ls_list(ARCHD *arcn, FILE *fp)
 {
 	struct stat *sbp;
 	char f_mode[MODELEN];
-	char f_date[DATELEN];
 	int term;
 
 	term = zeroflag ? '\0' : '\n';	/* path termination character */
@@ -124,9 +143,6 @@ ls_list(ARCHD *arcn, FILE *fp)
 	/*
 	 * print file mode, link count, uid, gid and time
 	 */
-	if (strftime(f_date, sizeof(f_date), TIMEFMT(sbp->st_mtime),
-	    localtime(&(sbp->st_mtime))) == 0)
-		f_date[0] = '\0';
 	(void)fprintf(fp, "%s%2u %-*.*s %-*.*s ", f_mode,
 	    (unsigned int)sbp->st_nlink,
 	    NAME_WIDTH, UT_NAMESIZE, name_uid(sbp->st_uid, 1),
@@ -145,7 +161,7 @@ ls_list(ARCHD *arcn, FILE *fp)
 	/*
 	 * print name and link info for hard and symbolic links
 	 */
-	(void)fputs(f_date, fp);
+	(void)fputs(ls_date(sbp->st_mtime), fp);
 	(void)putc(' ', fp);
 	safe_print(arcn->name, fp);
 	if (PAX_IS_HARDLINK(arcn->type)) {
@@ -156,7 +172,252 @@ ls_list(ARCHD *arcn, FILE *fp)
 		safe_print(arcn->ln_name, fp);
 	}
 	(void)putc(term, fp);
-	(void)fflush(fp);
+	/* list() has stdout fully buffered when it is not a terminal */
+	if ((act != LIST) || fp_isatty(fp))
+		(void)fflush(fp);
+}
+
+/*
+ * ls_json()
+ *	list an archive member as a JSON object on a line of its own (or,
+ *	with -0, terminated by a NUL), for other programs to read; hoff and
+ *	doff are the offsets of its header and data in the archive volume
+ *	(after decompression)
+ */
+
+void
+ls_json(ARCHD *arcn, FILE *fp, off_t hoff, off_t doff)
+{
+	struct stat *sbp;
+	const char *type;
+	long long sec;
+	long nsec;
+	struct {
+		time_t tv_sec;
+		long tv_nsec;
+	} ts;
+
+	sbp = &(arcn->sb);
+	switch (arcn->type) {
+	case PAX_DIR:
+		type = "dir";
+		break;
+	case PAX_CHR:
+		type = "chr";
+		break;
+	case PAX_BLK:
+		type = "blk";
+		break;
+	case PAX_REG:
+	case PAX_CTG:
+		type = "file";
+		break;
+	case PAX_SLK:
+		type = "symlink";
+		break;
+	case PAX_SCK:
+		type = "socket";
+		break;
+	case PAX_FIF:
+		type = "fifo";
+		break;
+	case PAX_HLK:
+	case PAX_HRG:
+		type = "hardlink";
+		break;
+	default:
+		type = "unknown";
+		break;
+	}
+
+	/* print the magnitude and sign, also before the epoch */
+	st_timexp(m, &ts, sbp);
+	sec = (long long)ts.tv_sec;
+	nsec = ts.tv_nsec;
+	if ((sec < 0) && (nsec > 0)) {
+		++sec;
+		nsec = 1000000000L - nsec;
+	}
+
+	(void)putc('{', fp);
+	json_name("path", arcn->name, fp);
+	(void)fprintf(fp, ",\"type\":\"%s\",\"size\":%" OT_FMT
+	    ",\"mode\":\"%04o\",\"uid\":%lu,\"gid\":%lu", type,
+	    sbp->st_size, (unsigned int)(sbp->st_mode & ABITS),
+	    (unsigned long)sbp->st_uid, (unsigned long)sbp->st_gid);
+	(void)fprintf(fp, ",\"mtime\":%s%lld.%09ld",
+	    ts.tv_sec < 0 ? "-" : "", sec < 0 ? -sec : sec, nsec);
+	if ((arcn->type == PAX_CHR) || (arcn->type == PAX_BLK))
+		(void)fprintf(fp, ",\"rdev\":[%lu,%lu]",
+		    (unsigned long)MAJOR(sbp->st_rdev),
+		    (unsigned long)MINOR(sbp->st_rdev));
+	if (PAX_IS_LINK(arcn->type)) {
+		(void)putc(',', fp);
+		json_name("link", arcn->ln_name, fp);
+	}
+	(void)fprintf(fp, ",\"offset\":%" OT_FMT ",\"data_offset\":%" OT_FMT
+	    "}", hoff, doff);
+	(void)putc(zeroflag ? '\0' : '\n', fp);
+	if (fp_isatty(fp))
+		(void)fflush(fp);
+}
+
+/*
+ * json_name()
+ *	print a name as the JSON string member key; bytes other than
+ *	quotes, backslashes and control characters are passed on as they
+ *	are. JSON text must be UTF-8, so a name which is not is printed
+ *	in base64 as member key_b64 instead.
+ */
+
+static void
+json_name(const char *key, const char *str, FILE *fp)
+{
+	static const char b64[] =
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const unsigned char *cp;
+	unsigned long v;
+	size_t len, i;
+
+	cp = (const unsigned char *)str;
+	if (!utf8_ok(cp)) {
+		(void)fprintf(fp, "\"%s_b64\":\"", key);
+		len = strlen(str);
+		for (i = 0; i < len; i += 3) {
+			v = (unsigned long)cp[i] << 16;
+			if (i + 1 < len)
+				v |= (unsigned long)cp[i + 1] << 8;
+			if (i + 2 < len)
+				v |= cp[i + 2];
+			(void)putc(b64[(v >> 18) & 0x3F], fp);
+			(void)putc(b64[(v >> 12) & 0x3F], fp);
+			(void)putc(i + 1 < len ? b64[(v >> 6) & 0x3F] : '=', fp);
+			(void)putc(i + 2 < len ? b64[v & 0x3F] : '=', fp);
+		}
+		(void)putc('"', fp);
+		return;
+	}
+
+	(void)fprintf(fp, "\"%s\":\"", key);
+	for (; *cp; ++cp) {
+		if ((*cp == '"') || (*cp == '\\')) {
+			(void)putc('\\', fp);
+			(void)putc(*cp, fp);
+		} else if ((*cp < 0x20) || (*cp == 0x7F))
+			(void)fprintf(fp, "\\u%04x", (unsigned int)*cp);
+		else
+			(void)putc(*cp, fp);
+	}
+	(void)putc('"', fp);
+}
+
+/*
+ * utf8_ok()
+ *	check a string for well-formed UTF-8 (no overlong forms, surrogates
+ *	or code points past U+10FFFF)
+ * Return:
+ *	1 if it is, 0 if not
+ */
+
+static int
+utf8_ok(const unsigned char *cp)
+{
+	unsigned int lo, hi;
+	int n;
+
+	while (*cp) {
+		if (*cp < 0x80) {
+			++cp;
+			continue;
+		}
+		lo = 0x80;
+		hi = 0xBF;
+		if ((*cp >= 0xC2) && (*cp <= 0xDF))
+			n = 1;
+		else if ((*cp >= 0xE0) && (*cp <= 0xEF)) {
+			n = 2;
+			if (*cp == 0xE0)
+				lo = 0xA0;
+			else if (*cp == 0xED)
+				hi = 0x9F;
+		} else if ((*cp >= 0xF0) && (*cp <= 0xF4)) {
+			n = 3;
+			if (*cp == 0xF0)
+				lo = 0x90;
+			else if (*cp == 0xF4)
+				hi = 0x8F;
+		} else
+			return (0);
+		/* the first continuation byte has a narrower range */
+		if ((*++cp < lo) || (*cp > hi))
+			return (0);
+		while (--n > 0)
+			if ((*++cp < 0x80) || (*cp > 0xBF))
+				return (0);
+		++cp;
+	}
+	return (1);
+}
+
+/*
+ * ls_date()
+ *	format a modification time for a long listing; the result is kept
+ *	for the whole minute (or day) it shows, so that archives with many
+ *	members of about the same age need few localtime(3) and strftime(3)
+ *	calls. A day across a time zone change is not kept.
+ * Return:
+ *	the date string
+ */
+
+static const char *
+ls_date(time_t t)
+{
+	struct datec *dc;
+	struct tm *tm;
+	struct tm ltm;
+	time_t unit;
+	char cur;
+
+	cur = ISCURTIME(t) ? 1 : 0;
+	unit = cur ? 60 : 24 * 60 * 60;
+	dc = &datec[(unsigned long)(t / unit) % DATECACHE];
+	if ((dc->hi != dc->lo) && (dc->cur == cur) &&
+	    (t >= dc->lo) && (t < dc->hi))
+		return (dc->date);
+
+	dc->lo = dc->hi = 0;
+	if (((tm = localtime(&t)) == NULL) ||
+	    (strftime(dc->date, sizeof(dc->date), cur ? CURFRMT : OLDFRMT,
+	    tm) == 0))
+		return ("");
+	dc->lo = t - tm->tm_sec;
+	if (!cur) {
+		dc->lo -= (tm->tm_hour * 60 + tm->tm_min) * 60;
+		/* a day with a time zone change is shorter or longer */
+		ltm = *tm;
+		if (!ls_sameday(dc->lo, &ltm) ||
+		    !ls_sameday(dc->lo + unit - 1, &ltm)) {
+			dc->lo = t;
+			unit = 1;
+		}
+	}
+	dc->hi = dc->lo + unit;
+	dc->cur = cur;
+	return (dc->date);
+}
+
+/*
+ * ls_sameday()
+ *	check if a time is on the same local day as the one in ref
+ */
+
+static int
+ls_sameday(time_t t, const struct tm *ref)
+{
+	struct tm *tm;
+
+	return (((tm = localtime(&t)) != NULL) &&
+	    (tm->tm_year == ref->tm_year) && (tm->tm_yday == ref->tm_yday));
 }
 
 /*
@@ -190,7 +451,7 @@ safe_print(const char *str, FILE *fp)
 	/*
 	 * if printing to a tty, use vis(3) to print special characters.
 	 */
-	if (isatty(fileno(fp))) {
+	if (fp_isatty(fp)) {
 		for (cp = str; *cp; cp++) {
 			(void)vis(visbuf, cp[0], VIS_CSTYLE, cp[1]);
 			(void)fputs(visbuf, fp);
@@ -200,6 +461,25 @@ safe_print(const char *str, FILE *fp)
 		(void)fputs(str, fp);
 }
 
+/*
+ * fp_isatty()
+ *	isatty(3) for a stdio stream, remembered for the last one asked
+ *	about so as to not make a syscall for every member listed
+ */
+
+static int
+fp_isatty(FILE *fp)
+{
+	static FILE *lastfp;
+	static int lastres;
+
+	if (fp != lastfp) {
+		lastres = isatty(fileno(fp));
+		lastfp = fp;
+	}
+	return (lastres);
+}
+
 /*
  * asc_ul()
  *	convert hex/octal character string into a u_long. We do not have to
@@ -396,6 +676,41 @@ ull_asc(unsigned long long val, char *str, int len, int base)
 	return(0);
 }
 
+/*
+ * sum_bytes()
+ *	add the bytes of a buffer to a file data checksum (as used by the
+ *	sv4crc format) eight at a time: the even and odd bytes of a word
+ *	go into 16-bit lanes, which do not overflow in 128 words, and the
+ *	lanes are then folded into the sum
+ * Return:
+ *	the new checksum
+ */
+
+uint32_t
+sum_bytes(uint32_t sum, const char *cp, size_t len)
+{
+	const uint64_t m8 = 0x00FF00FF00FF00FFULL;
+	const uint64_t m16 = 0x0000FFFF0000FFFFULL;
+	uint64_t w, acc;
+	size_t n;
+
+	while (len >= 8) {
+		n = MINIMUM(len / 8, 128);
+		len -= n * 8;
+		acc = 0;
+		while (n--) {
+			memcpy(&w, cp, 8);
+			cp += 8;
+			acc += (w & m8) + ((w >> 8) & m8);
+		}
+		acc = (acc & m16) + ((acc >> 16) & m16);
+		sum += (uint32_t)(acc + (acc >> 32));
+	}
+	while (len--)
+		sum += *cp++ & 0xFF;
+	return (sum);
+}
+
 /*
  * Copy at max min(bufz, fieldsz) chars from field to buf, stopping
  * at the first NUL char. NUL terminate buf if there is room left.
@@ -146,7 +146,7 @@ __RCSID("$MirOS: src/bin/pax/options.c,v 1.76 2021/10/03 20:48:06 tg Exp $");
 #define	BDEXTR	(AF|BF|LF|TF|WF|XF|CBF|CHF|CLF|CPF|CXF)
 #define	BDARCH	(CF|KF|LF|NF|PF|RF|CDF|CEF|CYF|CZF)
 #define	BDCOPY	(AF|BF|FF|OF|XF|CBF|CEF)
-#define	BDLIST	(AF|BF|IF|KF|LF|OF|PF|RF|TF|UF|WF|XF|CBF|CDF|CHF|CLF|CPF|CXF|CYF|CZF)
+#define	BDLIST	(AF|BF|IF|KF|LF|PF|RF|TF|UF|WF|XF|CBF|CDF|CHF|CLF|CPF|CXF|CYF|CZF)
 
 /*
  * Routines which handle command line options
@@ -164,7 +164,7 @@ static int mkpath(char *);
 static void process_M(const char *, void (*)(void));
 static void printflg(unsigned int);
 static int c_frmt(const void *, const void *);
-static off_t str_offt(char *);
+static off_t str_offt(const char *);
 static void pax_options(int, char **);
 static void pax_usage(void) MKSH_A_NORETURN;
 static void tar_set_action(int);
@@ -179,7 +179,9 @@ static int compress_id(char *_blk, int _size);
 static int gzip_id(char *_blk, int _size);
 static int bzip2_id(char *_blk, int _size);
 static int xz_id(char *_blk, int _size);
+static int zstd_id(char *_blk, int _size);
 #endif
+static int gen_opt(const char *, const char *);
 
 /* command to run as gzip */
 static const char GZIP_CMD[] = "gzip";
@@ -194,6 +196,8 @@ static const char XZ_CMD[] = "xz";
 static const char LZMA_WRCMD[] = "lzma";
 /* command to run as lzop */
 static const char LZOP_CMD[] = "lzop";
+/* command to run as zstd */
+static const char ZSTD_CMD[] = "zstd";
 #endif
 /* used as flag value */
 #define COMPRESS_GUESS_CMD ((const void *)&compress_program)
@@ -253,7 +257,7 @@ const FSUB fsub[] = {
 /* FSUB_USTAR: POSIX USTAR */
 	{"ustar", 10240, BLKMULT, 0, 1, BLKMULT, ustar_id, ustar_strd,
 	ustar_rd, tar_endrd, ustar_stwr, ustar_wr, tar_endwr, tar_trail,
-	rd_wrfile, wr_rdfile, tar_opt, 0, 0},
+	ustar_rddata, ustar_wrdata, tar_opt, 0, 0},
 
 #ifndef SMALL
 /* FSUB_V4NORM: SVR4 HEX CPIO WITH CRC, UID/GID/MTIME CLEARED (NORMALISED) */
@@ -282,6 +286,10 @@ const FSUB fsub[] = {
 	{NULL, 0, 4, 0, 0, 0, gzip_id, NULL,
 	NULL, NULL, NULL, NULL, NULL, NULL,
 	NULL, NULL, NULL, 0, 0},
+/* FSUBFAIL_ZSTD: zstd, to detect failure to use -Q */
+	{NULL, 0, 4, 0, 0, 0, zstd_id, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, 0, 0},
 #endif
 };
 
@@ -298,6 +306,7 @@ const unsigned char ford[] = {
 	FSUBFAIL_BZ2,
 	FSUBFAIL_XZ,
 	FSUBFAIL_Z,
+	FSUBFAIL_ZSTD,
 #endif
 	FSUB_SV4CRC,
 	FSUB_SV4CPIO,
@@ -389,7 +398,7 @@ pax_options(int argc, char **argv)
 	 * process option flags
 	 */
 	while ((c = getopt(argc, argv,
-	    "0aB:b:cDdE:f:G:HiJjkLlM:nOo:Pp:rs:T:tU:uvwXx:YZz")) != -1) {
+	    "0aB:b:cDdE:f:G:HiJjkLlM:nOo:Pp:Qrs:T:tU:uvwXx:YZz")) != -1) {
 		switch (c) {
 		case '0':
 			/*
@@ -511,6 +520,12 @@ pax_options(int argc, char **argv)
 			 */
 			compress_program = BZIP2_CMD;
 			break;
+		case 'Q':
+			/*
+			 * use zstd (non-standard option)
+			 */
+			compress_program = ZSTD_CMD;
+			break;
 #endif
 		case 'k':
 			/*
@@ -829,7 +844,7 @@ tar_options(int argc, char **argv)
 	 * process option flags
 	 */
 	while ((c = getoldopt(argc, argv,
-	    "014578AaBb:C:cD:ef:HhI:JjLM:mNOoPpqRrSs:tuvwXxZz")) != -1) {
+	    "014578AaBb:C:cD:ef:HhI:JjLM:mNOoPpQqRrSs:tuvwXxZz")) != -1) {
 		switch (c) {
 		case '0':
 			arcname = DEV_0;
@@ -961,6 +976,12 @@ tar_options(int argc, char **argv)
 			 */
 			compress_program = BZIP2_CMD;
 			break;
+		case 'Q':
+			/*
+			 * use zstd (non-standard option)
+			 */
+			compress_program = ZSTD_CMD;
+			break;
 #endif
 		case 'L':
 			/*
@@ -1500,6 +1521,12 @@ cpio_options(int argc, char **argv)
 			 */
 			compress_program = BZIP2_CMD;
 			break;
+		case 'Q':
+			/*
+			 * use zstd (non-standard option)
+			 */
+			compress_program = ZSTD_CMD;
+			break;
 #endif
 		case 'k':
 			break;
@@ -1604,7 +1631,7 @@ cpio_options(int argc, char **argv)
 			break;
 		}
 		if (opterr == 0) {
-			optstr = "06AaBbC:cdE:F:fH:I:iJjkLlM:mO:oprSstuVvZz";
+			optstr = "06AaBbC:cdE:F:fH:I:iJjkLlM:mO:opQrSstuVvZz";
 			opterr = 1;
 		}
 	}
@@ -1780,6 +1807,20 @@ opt_add(const char *str)
 			free(dstr);
 			return(-1);
 		}
+		/*
+		 * options for the compression program and the member
+		 * index are not passed on to the format
+		 */
+		*pt = '\0';
+		switch (gen_opt(frpt, pt + 1)) {
+		case 0:
+			frpt = endpt != NULL ? endpt + 1 : NULL;
+			continue;
+		case -1:
+			free(dstr);
+			return(-1);
+		}
+		*pt = '=';
 		if ((opt = malloc(sizeof(OPLIST))) == NULL) {
 			paxwarn(0, "Unable to allocate space for option list");
 			free(dstr);
@@ -1806,6 +1847,105 @@ opt_add(const char *str)
 	return(0);
 }
 
+/*
+ * gen_opt()
+ *	handle the options given to -o (or tar -D) which apply whatever
+ *	the archive format is:
+ *		compress.level=n	compression level (1-19)
+ *		compress.threads=n	compressor threads (0 = auto)
+ *		compress.index=n	write a gzip seek index (0/1)
+ *		iosize=n		archive read/write size in bytes
+ *		list.format=json	list members as JSON objects (or ls)
+ *		index=file		member index file to write or use
+ *		index.scan=file		member index file to make by listing
+ *		index.threads=n		index scan workers (0 = auto)
+ * Return:
+ *	0 if the option was taken, 1 if it is a format option, -1 if the
+ *	value is bad
+ */
+
+static int
+gen_opt(const char *name, const char *value)
+{
+	int *vp;
+	long long lo, hi;
+	off_t sz;
+	char *cp;
+#if HAVE_STRTONUM
+	const char *es;
+	long long i;
+#else
+	char *ep;
+	long long i;
+#endif
+
+	if (!strcmp(name, "index") || !strcmp(name, "index.scan")) {
+		if ((cp = strdup(value)) == NULL) {
+			paxwarn(0, "Unable to allocate space for option list");
+			return (-1);
+		}
+		if (name[5] == '\0')
+			idxname = cp;
+		else
+			idxscan = cp;
+		return (0);
+	}
+	if (!strcmp(name, "list.format")) {
+		if (!strcmp(value, "json"))
+			listjson = 1;
+		else if (!strcmp(value, "ls"))
+			listjson = 0;
+		else {
+			paxwarn(0, "invalid %s value: %s", name, value);
+			return (-1);
+		}
+		return (0);
+	}
+	if (!strcmp(name, "iosize")) {
+		if (((sz = str_offt(value)) <= 0) || (sz > MAXIOSZ) ||
+		    (sz % BLKMULT)) {
+			paxwarn(0, "invalid %s value: %s", name, value);
+			return (-1);
+		}
+		iosize = (int)sz;
+		return (0);
+	}
+	if (!strcmp(name, "compress.level")) {
+		vp = &compress_level;
+		lo = 1;
+		hi = 19;
+	} else if (!strcmp(name, "compress.threads")) {
+		vp = &compress_threads;
+		lo = 0;
+		hi = 1024;
+	} else if (!strcmp(name, "compress.index")) {
+		vp = &compress_index;
+		lo = 0;
+		hi = 1;
+	} else if (!strcmp(name, "index.threads")) {
+		vp = &idxthreads;
+		lo = 0;
+		hi = 1024;
+	} else
+		return (1);
+
+#if HAVE_STRTONUM
+	i = strtonum(value, lo, hi, &es);
+	if (es) {
+		paxwarn(0, "%s %s value: %s", es, name, value);
+		return (-1);
+	}
+#else
+	i = strtoll(value, &ep, 10);
+	if ((ep == value) || (*ep != '\0') || (i < lo) || (i > hi)) {
+		paxwarn(0, "invalid %s value: %s", name, value);
+		return (-1);
+	}
+#endif
+	*vp = (int)i;
+	return (0);
+}
+
 /*
  * str_offt()
  *	Convert an expression of the following forms to an off_t > 0.
@@ -1830,7 +1970,7 @@ opt_add(const char *str)
 #endif
 
 static off_t
-str_offt(char *val)
+str_offt(const char *val)
 {
 	char *expr;
 	off_t num, t;
@@ -1919,12 +2059,12 @@ pax_usage(void)
 #ifndef SMALL
 	    "paxmirabilis " MIRCPIO_VERSION "\n"
 #endif
-	    "usage: pax [-0cdJjnOvz] [-E limit] [-f archive] [-G group] [-s replstr]\n"
-	    "           [-T range] [-U user] [pattern ...]\n"
-	    "       pax -r [-0cDdiJjknOuvYZz] [-E limit] [-f archive] [-G group] [-M flag]\n"
+	    "usage: pax [-0cdJjnOQvz] [-E limit] [-f archive] [-G group] [-o options]\n"
+	    "           [-s replstr] [-T range] [-U user] [pattern ...]\n"
+	    "       pax -r [-0cDdiJjknOQuvYZz] [-E limit] [-f archive] [-G group] [-M flag]\n"
 	    "           [-o options] [-p string] [-s replstr] [-T range] [-U user]\n"
 	    "           [pattern ...]\n"
-	    "       pax -w [-0adHiJjLOPtuvXz] [-B bytes] [-b blocksize] [-f archive]\n"
+	    "       pax -w [-0adHiJjLOPQtuvXz] [-B bytes] [-b blocksize] [-f archive]\n"
 	    "           [-G group] [-M flag] [-o options] [-s replstr] [-T range]\n"
 	    "           [-U user] [-x format] [file ...]\n"
 	    "       pax -rw [-0DdHikLlnOPtuvXYZ] [-G group] [-p string] [-s replstr]\n"
@@ -1945,10 +2085,10 @@ tar_usage(void)
 #ifndef SMALL
 	    "paxmirabilis " MIRCPIO_VERSION "\n"
 #endif
-	    "usage: tar {crtux}[014578AabefHhJjLmNOoPpqRSsvwXZz]\n"
+	    "usage: tar {crtux}[014578AabefHhJjLmNOoPpQqRSsvwXZz]\n"
 	    "           [blocking-factor | archive | replstr] [-C directory] [-I file]\n"
 	    "           [file ...]\n"
-	    "       tar {-crtux} [-014578AaeHhJjLmNOoPpqRSvwXZz] [-b blocking-factor]\n"
+	    "       tar {-crtux} [-014578AaeHhJjLmNOoPpQqRSvwXZz] [-b blocking-factor]\n"
 	    "           [-C directory] [-D format-options] [-f archive] [-I file]\n"
 	    "           [-M flag] [-s replstr] [file ...]\n",
 	    stderr);
@@ -1967,9 +2107,9 @@ cpio_usage(void)
 #ifndef SMALL
 	    "paxmirabilis " MIRCPIO_VERSION "\n"
 #endif
-	    "usage: cpio -o [-0AaBcJjLVvZz] [-C bytes] [-F archive] [-H format]\n"
+	    "usage: cpio -o [-0AaBcJjLQVvZz] [-C bytes] [-F archive] [-H format]\n"
 	    "               [-M flag] [-O archive] <name-list [>archive]\n"
-	    "       cpio -i [-06BbcdfJjmrSstuVvZz] [-C bytes] [-E file] [-F archive]\n"
+	    "       cpio -i [-06BbcdfJjmQrSstuVvZz] [-C bytes] [-E file] [-F archive]\n"
 	    "               [-H format] [-I archive] [-M flag] [pattern ...] [<archive]\n"
 	    "       cpio -p [-0adLlmuVv] destination-directory <name-list\n",
 	    stderr);
@@ -2044,6 +2184,8 @@ process_M(const char *arg, void (*call_usage)(void))
 		k = ANON_NUMID;
 	} else if (!strncmp(arg, "gslash", 6)) {
 		k = ANON_DIRSLASH;
+	} else if (!strncmp(arg, "nohole", 6)) {
+		k = ANON_NOHOLE;
 	} else
 		call_usage();
 	if (j)
@@ -2116,6 +2258,13 @@ guess_compress_program(int wr __attribute__((__unused__)))
 		compress_program = LZOP_CMD;
 		return;
 	}
+
+	/* guess extended format zstd */
+	if (!strcmp(ccp, "zst") ||
+	    !strcmp(ccp, "tzst")) {
+		compress_program = ZSTD_CMD;
+		return;
+	}
 #endif
 
 	/* no sugar */
@@ -2167,6 +2316,17 @@ xz_id(char *blk, int size)
 	return (-1);
 }
 
+static int
+zstd_id(char *blk, int size)
+{
+	if (size >= 4 && memcmp(blk, "\x28\xB5\x2F\xFD", 4) == 0) {
+		paxwarn(0, "input compressed with %s; use the -%c option"
+		    " to decompress it", "zstd", 'Q');
+		exit(1);
+	}
+	return (-1);
+}
+
 void
 mircpio_deprecated(const char *what, const char *with)
 {
@@ -75,11 +75,36 @@ static PATTERN *pathead = NULL;		/* file pattern match list head */
 static PATTERN *pattail = NULL;		/* file pattern match list tail */
 static REPLACE *rephead = NULL;		/* replacement string list head */
 static REPLACE *reptail = NULL;		/* replacement string list tail */
+static size_t patseq = 0;		/* patterns added so far */
+
+/*
+ * The patterns compiled for pat_match(): literal ones (and directories
+ * matched under -n) are chained in a hash table by their string, the
+ * others hang off a trie of their literal prefixes (the part up to the
+ * first wildcard), so only the patterns which can match a member are
+ * looked at. Of those, the one first on the list is taken, as always.
+ */
+typedef struct ptrie {
+	struct ptrie	*kid;		/* first node one char further */
+	struct ptrie	*sib;		/* next node at the same depth */
+	PATTERN		*pats;		/* patterns whose prefix ends here */
+	char		c;		/* char leading to this node */
+} PTRIE;
+
+#define PATMETA		"*?[\\"	/* chars which make a wildcard */
+
+static PATTERN **pattab = NULL;		/* literal pattern hash table */
+static unsigned int pattabsz;		/* size of pattab */
+static PTRIE patroot;			/* trie of wildcard patterns */
 
 static int rep_name(char *, size_t, int *, int);
 static int tty_rename(ARCHD *);
 static int fix_path(char *, int *, char *, int);
 static int fn_match(char *, char *, char **);
+static int pat_comp(void);
+static int pat_hook(PATTERN *);
+static void pat_unhook(PATTERN *);
+static PATTERN *pat_lookup(const char *, size_t, int);
 static char * range_match(char *, int);
 static int resub(regex_t *, regmatch_t *, char *, char *, char *, char *);
 
@@ -252,9 +277,15 @@ pat_add(char *str, char *chdirname)
 	pt->pstr = str;
 	pt->pend = NULL;
 	pt->plen = strlen(str);
+	pt->pseq = patseq++;
 	pt->fow = NULL;
+	pt->hnext = NULL;
 	pt->flgs = 0;
 	pt->chdname = chdirname;
+	if ((pattab != NULL) && (pat_hook(pt) < 0)) {
+		free(pt);
+		return (-1);
+	}
 
 	if (pathead == NULL) {
 		pattail = pathead = pt;
@@ -314,6 +345,7 @@ pat_sel(ARCHD *arcn)
 	PATTERN *pt;
 	PATTERN **ppt;
 	size_t len;
+	char *str;
 
 	/*
 	 * if no patterns just return
@@ -357,7 +389,7 @@ pat_sel(ARCHD *arcn)
 		if (pt->pend != NULL)
 			*pt->pend = '\0';
 
-		if ((pt->pstr = strdup(arcn->name)) == NULL) {
+		if ((str = strdup(arcn->name)) == NULL) {
 			paxwarn(1, "%s for %s", "Out of memory",
 			    "pattern select");
 			if (pt->pend != NULL)
@@ -365,6 +397,8 @@ pat_sel(ARCHD *arcn)
 			pt->pend = NULL;
 			return(-1);
 		}
+		pat_unhook(pt);
+		pt->pstr = str;
 
 		/*
 		 * put the trailing / back in the source string
@@ -385,6 +419,8 @@ pat_sel(ARCHD *arcn)
 		}
 		pt->flgs = DIR_MTCH | MTCH;
 		arcn->pat = pt;
+		if ((pattab != NULL) && (pat_hook(pt) < 0))
+			return(-1);
 		return(0);
 	}
 
@@ -411,6 +447,7 @@ pat_sel(ARCHD *arcn)
 		return(-1);
 	}
 	*ppt = pt->fow;
+	pat_unhook(pt);
 	free(pt);
 	arcn->pat = NULL;
 	return(0);
@@ -431,7 +468,10 @@ pat_sel(ARCHD *arcn)
 int
 pat_match(ARCHD *arcn)
 {
-	PATTERN *pt;
+	PATTERN *pt, *np;
+	PTRIE *node;
+	char *cp, *pend;
+	size_t len;
 
 	arcn->pat = NULL;
 
@@ -445,28 +485,44 @@ pat_match(ARCHD *arcn)
 		return(0);
 	}
 
+	if ((pattab == NULL) && (pat_comp() < 0))
+		return(-1);
+
 	/*
-	 * have to search down the list one at a time looking for a match.
+	 * a literal pattern matches the name itself or, unless we have -d,
+	 * a directory above it. A pattern with DIR_MTCH set was matched
+	 * before to a directory as we must have -n set for this (but not
+	 * -d). It can only match CHILDREN of that directory, so it is only
+	 * looked up for those.
 	 */
-	pt = pathead;
-	while (pt != NULL) {
-		/*
-		 * check for a file name match unless we have DIR_MTCH set in
-		 * this pattern then we want a prefix match
-		 */
-		if (pt->flgs & DIR_MTCH) {
-			/*
-			 * this pattern was matched before to a directory
-			 * as we must have -n set for this (but not -d). We can
-			 * only match CHILDREN of that directory so we must use
-			 * an exact prefix match (no wildcards).
-			 */
-			if ((arcn->name[pt->plen] == '/') &&
-			    (strncmp(pt->pstr, arcn->name, pt->plen) == 0))
-				break;
-		} else if (fn_match(pt->pstr, arcn->name, &pt->pend) == 0)
+	len = strlen(arcn->name);
+	pt = pat_lookup(arcn->name, len, 1);
+	pend = NULL;
+	for (cp = arcn->name + 1; !dflag && ((cp = strchr(cp, '/')) != NULL);
+	    ++cp)
+		if (((np = pat_lookup(arcn->name, cp - arcn->name, 0)) != NULL) &&
+		    ((pt == NULL) || (np->pseq < pt->pseq))) {
+			pt = np;
+			pend = cp;
+		}
+	if (pt != NULL)
+		pt->pend = pend;
+
+	/*
+	 * the patterns with wildcards whose literal prefix the name starts
+	 * with, unless one earlier on the list matched already
+	 */
+	for (node = &patroot, cp = arcn->name; node != NULL; ) {
+		for (np = node->pats; np != NULL; np = np->hnext)
+			if (((pt == NULL) || (np->pseq < pt->pseq)) &&
+			    (fn_match(np->pstr, arcn->name, &np->pend) == 0))
+				pt = np;
+		if (*cp == '\0')
 			break;
-		pt = pt->fow;
+		for (node = node->kid; (node != NULL) && (node->c != *cp);
+		    node = node->sib)
+			;
+		++cp;
 	}
 
 	/*
@@ -491,6 +547,191 @@ pat_match(ARCHD *arcn)
 	return(1);
 }
 
+/*
+ * pat_lit()
+ *	tell whether archive members can be picked by their name alone,
+ *	which is when there are patterns, none of them has wildcards and
+ *	the sense of matching is not inverted (-c)
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+pat_lit(void)
+{
+	PATTERN *pt;
+
+	if ((pathead == NULL) || cflag)
+		return (0);
+	for (pt = pathead; pt != NULL; pt = pt->fow)
+		if (strpbrk(pt->pstr, PATMETA) != NULL)
+			return (0);
+	return (1);
+}
+
+/*
+ * pat_none()
+ *	tell whether every archive member matches, as no pattern was given
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+pat_none(void)
+{
+	return (pathead == NULL);
+}
+
+/*
+ * pat_cand()
+ *	when pat_lit() holds, tell whether the member named name (of len
+ *	bytes) may be selected by pat_match(): it is named by a pattern
+ *	or lies below one
+ * Return:
+ *	1 if it may, 0 if it cannot
+ */
+
+int
+pat_cand(const char *name, size_t len)
+{
+	const char *cp;
+
+	if ((pattab == NULL) && (pat_comp() < 0))
+		return (1);
+	while ((len > 1) && (name[len - 1] == '/'))
+		--len;
+	if (pat_lookup(name, len, 1) != NULL)
+		return (1);
+	for (cp = name + 1; (cp < name + len) &&
+	    ((cp = memchr(cp, '/', name + len - cp)) != NULL); ++cp)
+		if (pat_lookup(name, cp - name, 0) != NULL)
+			return (1);
+	return (0);
+}
+
+/*
+ * pat_comp()
+ *	compile the pattern list for pat_match() (see pattab)
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+static int
+pat_comp(void)
+{
+	PATTERN *pt;
+
+	for (pattabsz = 1, pt = pathead; pt != NULL; pt = pt->fow)
+		++pattabsz;
+	pattabsz += pattabsz / 2;
+	if ((pattab = calloc(pattabsz, sizeof(PATTERN *))) == NULL) {
+		paxwarn(1, "%s for %s", "Out of memory", "pattern table");
+		return (-1);
+	}
+	for (pt = pathead; pt != NULL; pt = pt->fow)
+		if (pat_hook(pt) < 0)
+			return (-1);
+	return (0);
+}
+
+/*
+ * pat_hook()
+ *	add a pattern to the hash table or the trie
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+static int
+pat_hook(PATTERN *pt)
+{
+	PTRIE *node, **npp;
+	PATTERN **ppt;
+	size_t i, len;
+
+	if ((pt->flgs & DIR_MTCH) || (strpbrk(pt->pstr, PATMETA) == NULL)) {
+		ppt = &pattab[st_hash(pt->pstr, pt->plen, pattabsz)];
+		pt->hnext = *ppt;
+		*ppt = pt;
+		return (0);
+	}
+
+	len = strcspn(pt->pstr, PATMETA);
+	for (node = &patroot, i = 0; i < len; ++i) {
+		for (npp = &node->kid; (*npp != NULL) &&
+		    ((*npp)->c != pt->pstr[i]); npp = &(*npp)->sib)
+			;
+		if (*npp == NULL) {
+			if ((*npp = calloc(1, sizeof(PTRIE))) == NULL) {
+				paxwarn(1, "%s for %s", "Out of memory",
+				    "pattern table");
+				return (-1);
+			}
+			(*npp)->c = pt->pstr[i];
+		}
+		node = *npp;
+	}
+	pt->hnext = node->pats;
+	node->pats = pt;
+	return (0);
+}
+
+/*
+ * pat_unhook()
+ *	take a pattern out of the hash table or the trie again (before it
+ *	is freed or its string changes)
+ */
+
+static void
+pat_unhook(PATTERN *pt)
+{
+	PTRIE *node;
+	PATTERN **ppt;
+	size_t i, len;
+
+	if (pattab == NULL)
+		return;
+	if ((pt->flgs & DIR_MTCH) || (strpbrk(pt->pstr, PATMETA) == NULL))
+		ppt = &pattab[st_hash(pt->pstr, pt->plen, pattabsz)];
+	else {
+		len = strcspn(pt->pstr, PATMETA);
+		for (node = &patroot, i = 0; (node != NULL) && (i < len); ++i)
+			for (node = node->kid; (node != NULL) &&
+			    (node->c != pt->pstr[i]); node = node->sib)
+				;
+		if (node == NULL)
+			return;
+		ppt = &node->pats;
+	}
+	while ((*ppt != NULL) && (*ppt != pt))
+		ppt = &(*ppt)->hnext;
+	if (*ppt != NULL)
+		*ppt = pt->hnext;
+}
+
+/*
+ * pat_lookup()
+ *	find the literal pattern (or directory matched under -n) which is
+ *	the string s of len bytes and comes first on the list; exact tells
+ *	whether s is the member name or a directory above the member
+ * Return:
+ *	the pattern, NULL if there is none
+ */
+
+static PATTERN *
+pat_lookup(const char *s, size_t len, int exact)
+{
+	PATTERN *pt, *res = NULL;
+
+	for (pt = pattab[st_hash(s, len, pattabsz)]; pt != NULL;
+	    pt = pt->hnext)
+		if ((pt->plen == len) && !memcmp(pt->pstr, s, len) &&
+		    (exact ? !(pt->flgs & DIR_MTCH) :
+		    (!dflag || (pt->flgs & DIR_MTCH))) &&
+		    ((res == NULL) || (pt->pseq < res->pseq)))
+			res = pt;
+	return (res);
+}
+
 /*
  * fn_match()
  * Return:
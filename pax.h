@@ -54,10 +54,12 @@ __IDSTRING(rcsid_pax_h, "$MirOS: src/bin/pax/pax.h,v 1.27 2024/08/18 00:12:43 tg
 #define	MAXBLK_POSIX	32256	/* MAX blocksize supported as per POSIX */
 #define BLKMULT		512	/* blocksize must be even mult of 512 bytes */
 				/* Don't even think of changing this */
+#define MAXIOSZ		(16 * 1048576)	/* MAX -o iosize (not in the archive) */
 #define DEVBLK		8192	/* default read blksize for devices */
 #define FILEBLK		10240	/* default read blksize for files */
 #define PAXPATHLEN	3072	/* maximum path length for pax. MUST be */
 				/* longer than the system PATH_MAX */
+#define LISTBUFSZ	65536	/* stdio buffer for listing to a file */
 
 /*
  * pax modes of operation
@@ -88,10 +90,12 @@ typedef struct pattern {
 	char		*pend;		/* end of a prefix match */
 	char		*chdname;	/* the dir to change to if not NULL.  */
 	size_t		plen;		/* length of pstr */
+	size_t		pseq;		/* position in the pattern list */
 	int		flgs;		/* processing/state flags */
 #define MTCH		0x1		/* pattern has been matched */
 #define DIR_MTCH	0x2		/* pattern matched a directory */
 	struct pattern	*fow;		/* next pattern */
+	struct pattern	*hnext;		/* next in hash chain or trie node */
 } PATTERN;
 
 /*
@@ -140,6 +144,22 @@ typedef struct {
 #define PAX_IS_HARDLINK(type)	((type) == PAX_HLK || (type) == PAX_HRG)
 #define PAX_IS_LINK(type)	((type) == PAX_SLK || PAX_IS_HARDLINK(type))
 
+/*
+ * Header found by the parallel member index scan (see ustar_hdinfo()).
+ * A GNU long name or extended header has type PAX_GLF and belongs to the
+ * member after it; if nlen is not 0 (or size is not -1) it sets the
+ * name (or size) of that member.
+ */
+typedef struct {
+	off_t off;			/* offset of the header */
+	off_t next;			/* offset of the header after it */
+	off_t size;			/* member size */
+	long long mtime;		/* member mtime */
+	int type;			/* type of file node */
+	int nlen;			/* member name length */
+	char name[PAXPATHLEN+1];	/* member name */
+} IDXHD;
+
 /*
  * Format Specific Routine Table
  *
@@ -252,7 +272,8 @@ typedef struct oplist {
 #define	ANON_LNCP	0x0040
 #define	ANON_NUMID	0x0080
 #define	ANON_DIRSLASH	0x0100
-#define	ANON_MAXVAL	0x01FF
+#define	ANON_NOHOLE	0x0200
+#define	ANON_MAXVAL	0x03FF
 
 /* format table, see FSUB fsub[] in options.c */
 
@@ -278,6 +299,7 @@ enum fsub_order {
 	FSUBFAIL_XZ,
 	FSUBFAIL_BZ2,
 	FSUBFAIL_GZ,
+	FSUBFAIL_ZSTD,
 #endif
 	FSUB_MAX
 };
@@ -127,6 +127,20 @@ sel_chk(ARCHD *arcn)
 	return(0);
 }
 
+/*
+ * sel_none()
+ *	tell whether sel_chk() passes every member, as no uid, gid or time
+ *	range was specified
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+sel_none(void)
+{
+	return ((usrtb == NULL) && (grptb == NULL) && (trhead == NULL));
+}
+
 /*
  * User/group selection routines
  *
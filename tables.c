@@ -49,10 +49,12 @@
 #include <time.h>
 #endif
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -91,47 +93,66 @@ __RCSID("$MirOS: src/bin/pax/tables.c,v 1.33 2024/08/17 23:33:52 tg Exp $");
  */
 
 /*
- * Hash Table Sizes MUST BE PRIME, if set too small performance suffers.
- * Probably safe to expect 500000 inodes per tape. Assuming good key
- * distribution (inodes) chains of under 50 long (worst case) is ok.
+ * Chained Hash Table Sizes MUST BE PRIME, if set too small performance
+ * suffers. The tables keyed by device and inode number are open addressed
+ * and grow as needed; their sizes are the initial ones and powers of two.
  */
-#define L_TAB_SZ	2503		/* hard link hash table size */
-#define F_TAB_SZ	50503		/* file time hash table size */
+#define L_TAB_SZ	4096		/* initial hard link table size (2^n) */
+#define F_TAB_SZ	65536		/* initial file time table size (2^n) */
+#define F_CHUNK		65536		/* file time name arena chunk size */
+#define F_MEMMAX	(64UL * 1048576UL) /* arena size before names spill */
 #define N_TAB_SZ	541		/* interactive rename hash table */
-#define D_TAB_SZ	317		/* unique device mapping table */
-#define A_TAB_SZ	317		/* ftree dir access time reset table */
-#define SL_TAB_SZ	317		/* escape symlink tables */
+#define D_TAB_SZ	64		/* unique device mapping table (2^n) */
+#define A_TAB_SZ	512		/* ftree dir access time reset table (2^n) */
+#define SL_TAB_SZ	64		/* escape symlink tables (2^n) */
 #define MAXKEYLEN	64		/* max number of chars for hash */
-#define DIRP_SIZE	64		/* initial size of created dir table */
+#define DIRP_CHUNK	1024		/* created dir table entries per chunk */
+#define DIRP_TAB_SZ	1024		/* created dir index initial size (2^n) */
 
 /*
- * file hard link structure (hashed by dev/ino and chained) used to find the
+ * Open addressed hash table keyed by device and inode number, shared by
+ * the tables below which are looked up by file identity. The keys are
+ * stored in the slots, next to a pointer to the entry, so that probing
+ * does not touch the entries. Linear probing is used; the table doubles
+ * when it is three quarters full, and deletion shifts the following
+ * entries back instead of leaving tombstones.
+ */
+typedef struct dislot {
+	dev_t		dev;	/* device number of the key */
+	ino_t		ino;	/* inode number of the key */
+	void		*ent;	/* entry, NULL for a free slot */
+} DISLOT;
+
+typedef struct ditab {
+	DISLOT		*slot;	/* the slots, NULL if not yet created */
+	size_t		mask;	/* number of slots (2^n) minus one */
+	size_t		cnt;	/* number of used slots */
+} DITAB;
+
+/*
+ * file hard link structure (hashed by dev/ino) used to find the
  * hard links in a filesystem or with some archive formats (cpio)
  */
 typedef struct hrdlnk {
-	ino_t		ino;	/* files inode number */
 	char		*name;	/* name of first file seen with this ino/dev */
-	dev_t		dev;	/* files device number */
 	u_long		nlink;	/* expected link count */
-	struct hrdlnk	*fow;
 } HRDLNK;
 
 /*
  * Archive write update file time table (the -u, -C flag), hashed by filename.
- * Filenames are stored in a scratch file at seek offset into the file. The
- * file time (mod time) and the file name length (for a quick check) are
- * stored in a hash table node. We were forced to use a scratch file because
- * with -u, the mtime for every node in the archive must always be available
- * to compare against (and this data can get REALLY large with big archives).
- * By being careful to read only when we have a good chance of a match, the
- * performance loss is not measurable (and the size of the archive we can
- * handle is greatly increased).
+ * The table is open addressed (linear probing) and doubles in size when it
+ * is three quarters full; entries are stored inline. Filenames are stored in
+ * an in-memory arena, or in a scratch file once the arena has reached its
+ * size limit, at the position recorded in the entry. The full hash of the
+ * name and its length are kept in the entry so that a name is only looked
+ * at (and, if spilled, read back) when it is almost certain to match.
  */
 typedef struct ftm {
-	off_t		seek;		/* location in scratch file */
-	struct ftm	*fow;
-	int		namelen;	/* file name length */
-	struct stat	sb;		/* files last modification time */
+	off_t		seek;		/* arena offset, or -(file offset + 1) */
+	time_t		mtime;		/* files last modification time */
+	long		mtimensec;
+	unsigned int	hash;		/* full hash of the file name */
+	int		namelen;	/* file name length, 0 for a free slot */
 } FTM;
 
 /*
@@ -175,7 +196,6 @@ typedef struct namt {
 
 typedef struct devt {
 	dev_t		dev;	/* the orig device number we now have to map */
-	struct devt	*fow;	/* new device map list */
 	struct dlist	*list;	/* map list based on inode truncation bits */
 } DEVT;
 
@@ -190,12 +210,11 @@ typedef struct dlist {
  * subtree we reset the access and mod time of the directory when the tflag is
  * set. Not really explicitly specified in the pax spec, but easy and fast to
  * do (and this may have even been intended in the spec, it is not clear).
- * table is hashed by inode with chaining.
+ * table is hashed by device and inode.
  */
 
 typedef struct atdir {
 	struct file_times ft;
-	struct atdir *fow;
 } ATDIR;
 
 /*
@@ -205,7 +224,8 @@ typedef struct atdir {
  * times and/or modes). We must reset time in the reverse order of creation,
  * because entries are added  from the top of the file tree to the bottom.
  * We MUST reset times from leaf to root (it will not work the other
- * direction).
+ * direction). The entries are kept in fixed size chunks, so they do not
+ * move, and are also indexed by device and inode number.
  */
 
 typedef struct dirdata {
@@ -215,28 +235,57 @@ typedef struct dirdata {
 } DIRDATA;
 
 /*
- * file hard link structure (hashed by dev/ino and chained) for anonymisation
+ * file hard link structure (hashed by dev/ino) for anonymisation
  */
 typedef struct hrdflnk {
-	dev_t		dev;	/* files device number */
-	ino_t		ino;	/* files inode number */
 	u_long		nlink;	/* expected link count */
 	ino_t		newi;	/* new inode number */
-	struct hrdflnk	*fow;
 } HRDFLNK;
 
-static HRDLNK **ltab = NULL;	/* hard link table for detecting hard links */
-static HRDFLNK **fltab = NULL;	/* hard link table for anonymisation */
-static FTM **ftab = NULL;	/* file time table for updating arch */
+static DITAB ltab;		/* hard link table for detecting hard links */
+static DITAB fltab;		/* hard link table for anonymisation */
+static FTM *ftab = NULL;	/* file time table for updating arch */
+static size_t ftabsz;		/* slots in the file time table */
+static size_t ftabcnt;		/* used slots in the file time table */
+static char **farena = NULL;	/* file time table name arena chunks */
+static size_t farenacnt;	/* chunks in the name arena */
+static size_t farenapos;	/* free space offset in the last chunk */
 static NAMT **ntab = NULL;	/* interactive rename storage table */
-static DEVT **dtab = NULL;	/* device/inode mapping tables */
-static ATDIR **atab = NULL;	/* file tree directory time reset table */
-static DIRDATA *dirp = NULL;	/* storage for setting created dir time/mode */
-static size_t dirsize;		/* size of dirp table */
+static DITAB dtab;		/* device/inode mapping tables */
+static DITAB atab;		/* file tree directory time reset table */
+static DIRDATA **dirp = NULL;	/* storage for setting created dir time/mode */
+static size_t dirsize;		/* number of chunk pointers in dirp */
 static size_t dircnt = 0;	/* entries in dir time/mode storage */
-static int ffd = -1;		/* tmp file for file time table name storage */
+static DITAB dirtab;		/* created dir entries by dev/ino */
+#if HAVE_OPENAT
+static struct dirfds {
+	dev_t		dev;
+	ino_t		ino;
+	int		fd;
+} *dirfds = NULL;		/* directories created dir names are under */
+static size_t ndirfds;		/* number of dirfds entries */
+#endif
+static int ffd = -1;		/* tmp file for file time table name spill */
+static off_t ffdpos;		/* end of the spilled names in ffd */
 
 static DEVT *chk_dev(dev_t, int);
+#if HAVE_OPENAT
+static int dir_cwdfd(void);
+#endif
+static unsigned int dit_hash(dev_t, ino_t);
+static int dit_init(DITAB *, size_t);
+static DISLOT *dit_probe(DISLOT *, size_t, dev_t, ino_t);
+static DISLOT *dit_find(DITAB *, dev_t, ino_t);
+static int dit_add(DITAB *, dev_t, ino_t, void *);
+static void dit_del(DITAB *, DISLOT *);
+static unsigned int ftime_hash(const char *, int);
+static int ftime_grow(void);
+static int ftime_name(const char *, int, off_t *);
+static void idx_put(off_t, off_t, int, long long, const char *);
+static void idx_scanwrk(off_t, off_t, int) MKSH_A_NORETURN;
+static int idx_join(off_t, int, pid_t *, int *);
+static int idx_hdwr(FILE *, IDXHD *);
+static int idx_hdrd(FILE *, IDXHD *);
 
 #ifndef REALPATH_CAN_ALLOCATE
 static char realname[PATH_MAX];
@@ -282,9 +331,9 @@ xrealpath(const char *path)
 int
 lnk_start(void)
 {
-	if (ltab != NULL)
+	if (ltab.slot != NULL)
 		return (0);
-	if ((ltab = calloc(L_TAB_SZ, sizeof(HRDLNK *))) == NULL) {
+	if (dit_init(&ltab, L_TAB_SZ) < 0) {
 		paxwarn(1, "%s for %s", "Out of memory",
 		    "hard link table");
 		return (-1);
@@ -308,10 +357,9 @@ int
 chk_lnk(ARCHD *arcn)
 {
 	HRDLNK *pt;
-	HRDLNK **ppt;
-	unsigned int indx;
+	DISLOT *sp;
 
-	if (ltab == NULL)
+	if (ltab.slot == NULL)
 		return(-1);
 	/*
 	 * ignore those nodes that cannot have hard links
@@ -320,64 +368,49 @@ chk_lnk(ARCHD *arcn)
 		return(0);
 
 	/*
-	 * hash inode number and look for this file
+	 * hash inode and device number and look for this file
 	 */
-	indx = ((unsigned)arcn->sb.st_ino) % L_TAB_SZ;
-	if ((pt = ltab[indx]) != NULL) {
+	if ((sp = dit_find(&ltab, arcn->sb.st_dev, arcn->sb.st_ino)) != NULL) {
 		/*
-		 * its hash chain in not empty, walk down looking for it
+		 * found a link. set the node type and copy in the
+		 * name of the file it is to link to. we need to
+		 * handle hardlinks to regular files differently than
+		 * other links.
 		 */
-		ppt = &(ltab[indx]);
-		while (pt != NULL) {
-			if ((pt->ino == arcn->sb.st_ino) &&
-			    (pt->dev == arcn->sb.st_dev))
-				break;
-			ppt = &(pt->fow);
-			pt = pt->fow;
-		}
+		pt = sp->ent;
+		arcn->ln_nlen = strlcpy(arcn->ln_name, pt->name,
+			sizeof(arcn->ln_name));
+		/* XXX truncate? */
+		if ((size_t)arcn->nlen >= sizeof(arcn->name))
+			arcn->nlen = sizeof(arcn->name) - 1;
+		if (arcn->type == PAX_REG)
+			arcn->type = PAX_HRG;
+		else
+			arcn->type = PAX_HLK;
 
-		if (pt != NULL) {
-			/*
-			 * found a link. set the node type and copy in the
-			 * name of the file it is to link to. we need to
-			 * handle hardlinks to regular files differently than
-			 * other links.
-			 */
-			arcn->ln_nlen = strlcpy(arcn->ln_name, pt->name,
-				sizeof(arcn->ln_name));
-			/* XXX truncate? */
-			if ((size_t)arcn->nlen >= sizeof(arcn->name))
-				arcn->nlen = sizeof(arcn->name) - 1;
-			if (arcn->type == PAX_REG)
-				arcn->type = PAX_HRG;
-			else
-				arcn->type = PAX_HLK;
-
-			/*
-			 * if we have found all the links to this file, remove
-			 * it from the database
-			 */
-			if (--pt->nlink <= 1) {
-				*ppt = pt->fow;
-				free(pt->name);
-				free(pt);
-			}
-			return(1);
+		/*
+		 * if we have found all the links to this file, remove
+		 * it from the database
+		 */
+		if (--pt->nlink <= 1) {
+			dit_del(&ltab, sp);
+			free(pt->name);
+			free(pt);
 		}
+		return(1);
 	}
 
 	/*
 	 * we never saw this file before. It has links so we add it to the
-	 * front of this hash chain
+	 * table
 	 */
 	if ((pt = malloc(sizeof(HRDLNK))) != NULL) {
 		if ((pt->name = strdup(arcn->name)) != NULL) {
-			pt->dev = arcn->sb.st_dev;
-			pt->ino = arcn->sb.st_ino;
 			pt->nlink = arcn->sb.st_nlink;
-			pt->fow = ltab[indx];
-			ltab[indx] = pt;
-			return(0);
+			if (dit_add(&ltab, arcn->sb.st_dev, arcn->sb.st_ino,
+			    pt) == 0)
+				return(0);
+			free(pt->name);
 		}
 		free(pt);
 	}
@@ -397,10 +430,9 @@ void
 purg_lnk(ARCHD *arcn)
 {
 	HRDLNK *pt;
-	HRDLNK **ppt;
-	unsigned int indx;
+	DISLOT *sp;
 
-	if (ltab == NULL)
+	if (ltab.slot == NULL)
 		return;
 	/*
 	 * do not bother to look if it could not be in the database
@@ -410,31 +442,12 @@ purg_lnk(ARCHD *arcn)
 		return;
 
 	/*
-	 * find the hash chain for this inode value, if empty return
+	 * look for the inode/dev pair, remove and free if found
 	 */
-	indx = ((unsigned)arcn->sb.st_ino) % L_TAB_SZ;
-	if ((pt = ltab[indx]) == NULL)
-		return;
-
-	/*
-	 * walk down the list looking for the inode/dev pair, unlink and
-	 * free if found
-	 */
-	ppt = &(ltab[indx]);
-	while (pt != NULL) {
-		if ((pt->ino == arcn->sb.st_ino) &&
-		    (pt->dev == arcn->sb.st_dev))
-			break;
-		ppt = &(pt->fow);
-		pt = pt->fow;
-	}
-	if (pt == NULL)
+	if ((sp = dit_find(&ltab, arcn->sb.st_dev, arcn->sb.st_ino)) == NULL)
 		return;
-
-	/*
-	 * remove and free it
-	 */
-	*ppt = pt->fow;
+	pt = sp->ent;
+	dit_del(&ltab, sp);
 	free(pt->name);
 	free(pt);
 }
@@ -450,29 +463,20 @@ purg_lnk(ARCHD *arcn)
 void
 lnk_end(void)
 {
-	int i;
 	HRDLNK *pt;
-	HRDLNK *ppt;
+	size_t i;
 
-	if (ltab == NULL)
+	if (ltab.slot == NULL)
 		return;
 
-	for (i = 0; i < L_TAB_SZ; ++i) {
-		if (ltab[i] == NULL)
+	for (i = 0; i <= ltab.mask; ++i) {
+		if ((pt = ltab.slot[i].ent) == NULL)
 			continue;
-		pt = ltab[i];
-		ltab[i] = NULL;
-
-		/*
-		 * free up each entry on this chain
-		 */
-		while (pt != NULL) {
-			ppt = pt;
-			pt = ppt->fow;
-			free(ppt->name);
-			free(ppt);
-		}
+		ltab.slot[i].ent = NULL;
+		free(pt->name);
+		free(pt);
 	}
+	ltab.cnt = 0;
 }
 
 /*
@@ -485,25 +489,21 @@ lnk_end(void)
  * name on the archive it is added). This applies to writes and appends.
  * An append with an -u must read the archive and store the modification time
  * for every file on that archive before starting the write phase. It is clear
- * that this is one HUGE database. To save memory space, the actual file names
- * are stored in a scratch file and indexed by an in-memory hash table. The
- * hash table is indexed by hashing the file path. The nodes in the table store
- * the length of the filename and the lseek offset within the scratch file
- * where the actual name is stored. Since there are never any deletions from
- * this table, fragmentation of the scratch file is never a issue. Lookups
- * seem to not exhibit any locality at all (files in the database are rarely
- * looked up more than once...), so caching is just a waste of memory. The
- * only limitation is the amount of scratch file space available to store the
- * path names.
+ * that this is one HUGE database. The actual file names are packed into an
+ * arena of large chunks, and the hash table indexed by hashing the file path
+ * stores the full hash, the length of the filename and the offset where the
+ * actual name is stored. Since there are never any deletions from this table,
+ * fragmentation is never a issue. To bound memory use, names past F_MEMMAX
+ * bytes of arena are written to a scratch file instead, which is only read
+ * on a full hash and length match, so lookups cost no syscalls otherwise.
  */
 
 /*
  * ftime_start()
- *	create the file time hash table and open for read/write the scratch
- *	file. (after created it is unlinked, so when we exit we leave
- *	no witnesses).
+ *	create the file time hash table. The scratch file for names beyond
+ *	the arena size limit is only created once it is needed.
  * Return:
- *	0 if the table and file was created ok, -1 otherwise
+ *	0 if the table was created ok, -1 otherwise
  */
 
 int
@@ -512,31 +512,20 @@ ftime_start(void)
 
 	if (ftab != NULL)
 		return (0);
-	if ((ftab = calloc(F_TAB_SZ, sizeof(FTM *))) == NULL) {
+	if ((ftab = calloc(F_TAB_SZ, sizeof(FTM))) == NULL) {
 		paxwarn(1, "%s for %s", "Out of memory",
 		    "file time table");
 		return (-1);
 	}
-
-	/*
-	 * get random name and create temporary scratch file, unlink name
-	 * so it will get removed on exit
-	 */
-	memcpy(tempbase, _TFILE_BASE, sizeof(_TFILE_BASE));
-	if ((ffd = mkstemp(tempfile)) < 0) {
-		syswarn(1, errno, "Unable to create temporary file %s",
-		    tempfile);
-		return (-1);
-	}
-	(void)unlink(tempfile);
-
+	ftabsz = F_TAB_SZ;
+	ftabcnt = 0;
 	return(0);
 }
 
 /*
  * chk_ftime()
  *	looks up entry in file time hash table. If not found, the file is
- *	added to the hash table and the file named stored in the scratch file.
+ *	added to the hash table and the file named stored in the arena.
  *	If a file with the same name is found, the file times are compared and
  *	the most recent file time is retained. If the new file was younger (or
  *	was not in the database) the new file is selected for storage.
@@ -550,101 +539,188 @@ chk_ftime(ARCHD *arcn)
 {
 	FTM *pt;
 	int namelen;
-	unsigned int indx;
+	unsigned int hash;
+	size_t indx;
+	struct timespec ts;
 	char ckname[PAXPATHLEN+1];
+	const char *name;
 
 	/*
 	 * no info, go ahead and add to archive
 	 */
-	if (ftab == NULL)
+	if ((ftab == NULL) || ((namelen = arcn->nlen) <= 0))
 		return(0);
+	st_timexp(m, &ts, &arcn->sb);
 
 	/*
-	 * hash the pathname and look up in table
+	 * hash the pathname and probe the table until a free slot; only
+	 * look at the names if the full hash and length match
 	 */
-	namelen = arcn->nlen;
-	indx = st_hash(arcn->name, namelen, F_TAB_SZ);
-	if ((pt = ftab[indx]) != NULL) {
-		/*
-		 * the hash chain is not empty, walk down looking for match
-		 * only read up the path names if the lengths match, speeds
-		 * up the search a lot
-		 */
-		while (pt != NULL) {
-			if (pt->namelen == namelen) {
-				/*
-				 * potential match, have to read the name
-				 * from the scratch file.
-				 */
-				if (lseek(ffd,pt->seek,SEEK_SET) != pt->seek) {
-					syswarn(1, errno, "Failed %s on %s",
-					    "seek", "file time table");
-					return (-1);
-				}
-				if (read(ffd, ckname, namelen) != namelen) {
-					syswarn(1, errno, "Failed %s on %s",
-					    "read", "file time table");
-					return (-1);
-				}
-
-				/*
-				 * if the names match, we are done
-				 */
-				if (!strncmp(ckname, arcn->name, namelen))
-					break;
+	hash = ftime_hash(arcn->name, namelen);
+	for (indx = hash & (ftabsz - 1); (pt = &ftab[indx])->namelen != 0;
+	    indx = (indx + 1) & (ftabsz - 1)) {
+		if ((pt->hash != hash) || (pt->namelen != namelen))
+			continue;
+		if (pt->seek >= 0)
+			name = farena[pt->seek / F_CHUNK] +
+			    (size_t)(pt->seek % F_CHUNK);
+		else {
+			if (pread(ffd, ckname, namelen, -(pt->seek + 1)) !=
+			    namelen) {
+				syswarn(1, errno, "Failed %s on %s",
+				    "read", "file time table");
+				return (-1);
 			}
-
-			/*
-			 * try the next entry on the chain
-			 */
-			pt = pt->fow;
+			name = ckname;
 		}
+		if (memcmp(name, arcn->name, namelen))
+			continue;
 
-		if (pt != NULL) {
-			/*
-			 * found the file, compare the times, save the newer
-			 */
-			if (st_timecmp(m, &arcn->sb, &pt->sb, >)) {
-				/*
-				 * file is newer
-				 */
-				st_timecpy(m, &pt->sb, &arcn->sb);
-				return(0);
-			}
+		/*
+		 * found the file, compare the times, save the newer
+		 */
+		if ((ts.tv_sec > pt->mtime) || ((ts.tv_sec == pt->mtime) &&
+		    (ts.tv_nsec > pt->mtimensec))) {
 			/*
-			 * file is older
+			 * file is newer
 			 */
-			return(1);
+			pt->mtime = ts.tv_sec;
+			pt->mtimensec = ts.tv_nsec;
+			return(0);
 		}
+		/*
+		 * file is older
+		 */
+		return(1);
 	}
 
 	/*
-	 * not in table, add it
+	 * not in table, add it (pt is the free slot found)
 	 */
-	if ((pt = malloc(sizeof(FTM))) != NULL) {
-		/*
-		 * add the name at the end of the scratch file, saving the
-		 * offset. add the file to the head of the hash chain
-		 */
-		if ((pt->seek = lseek(ffd, 0, SEEK_END)) >= 0) {
-			if (write(ffd, arcn->name, namelen) == namelen) {
-				st_timecpy(m, &pt->sb, &arcn->sb);
-				pt->namelen = namelen;
-				pt->fow = ftab[indx];
-				ftab[indx] = pt;
-				return(0);
-			}
-			syswarn(1, errno, "Failed %s on %s",
-			    "write", "file time table");
-		} else
-			syswarn(1, errno, "Failed %s on %s",
-			    "seek", "file time table");
-	} else
+	if (ftime_name(arcn->name, namelen, &pt->seek) < 0)
+		return (-1);
+	pt->mtime = ts.tv_sec;
+	pt->mtimensec = ts.tv_nsec;
+	pt->hash = hash;
+	pt->namelen = namelen;
+	if ((++ftabcnt > ftabsz / 4 * 3) && (ftime_grow() < 0))
+		return (-1);
+	return(0);
+}
+
+/*
+ * ftime_hash()
+ *	hash a file name for the file time table (FNV-1a). Unlike st_hash(),
+ *	this looks at the entire name, as the full value is kept to avoid
+ *	name comparisons.
+ * Return:
+ *	the 32-bit hash value
+ */
+
+static unsigned int
+ftime_hash(const char *name, int len)
+{
+	const unsigned char *pt = (const unsigned char *)name;
+	unsigned int key = 2166136261U;
+
+	while (len-- > 0) {
+		key ^= *pt++;
+		key *= 16777619U;
+	}
+	return (key & 0xFFFFFFFFU);
+}
+
+/*
+ * ftime_grow()
+ *	double the size of the file time table, rehashing from the stored
+ *	hash values (the names are not needed for this)
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+ftime_grow(void)
+{
+	FTM *ntab;
+	size_t i, indx, nsz = ftabsz * 2;
+
+	if ((ntab = calloc(nsz, sizeof(FTM))) == NULL) {
 		paxwarn(1, "%s for %s", "Out of memory", "file time table");
+		return (-1);
+	}
+	for (i = 0; i < ftabsz; ++i) {
+		if (ftab[i].namelen == 0)
+			continue;
+		for (indx = ftab[i].hash & (nsz - 1); ntab[indx].namelen != 0;
+		    indx = (indx + 1) & (nsz - 1))
+			/* nothing */;
+		ntab[indx] = ftab[i];
+	}
+	free(ftab);
+	ftab = ntab;
+	ftabsz = nsz;
+	return (0);
+}
 
-	if (pt != NULL)
-		free(pt);
-	return(-1);
+/*
+ * ftime_name()
+ *	store a file name for the file time table, in the arena while it
+ *	is below F_MEMMAX bytes, appended to the scratch file otherwise.
+ *	Names never cross arena chunk boundaries. The position is stored
+ *	in seek as the arena offset or -(scratch file offset + 1).
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+ftime_name(const char *name, int len, off_t *seek)
+{
+	char **np;
+
+	if ((farenacnt == 0) || (farenapos + len > F_CHUNK)) {
+		if ((farenacnt + 1) * (size_t)F_CHUNK > F_MEMMAX)
+			goto spill;
+		if ((np = reallocarray(farena, farenacnt + 1,
+		    sizeof(char *))) == NULL)
+			goto nomem;
+		farena = np;
+		if ((farena[farenacnt] = malloc(F_CHUNK)) == NULL)
+			goto nomem;
+		++farenacnt;
+		farenapos = 0;
+	}
+	memcpy(farena[farenacnt - 1] + farenapos, name, len);
+	*seek = (off_t)(farenacnt - 1) * F_CHUNK + farenapos;
+	farenapos += len;
+	return (0);
+
+ nomem:
+	paxwarn(1, "%s for %s", "Out of memory", "file time table");
+	return (-1);
+
+ spill:
+	if (ffd == -1) {
+		/*
+		 * get random name and create temporary scratch file, unlink
+		 * name so it will get removed on exit
+		 */
+		memcpy(tempbase, _TFILE_BASE, sizeof(_TFILE_BASE));
+		if ((ffd = mkstemp(tempfile)) < 0) {
+			syswarn(1, errno, "Unable to create temporary file %s",
+			    tempfile);
+			return (-1);
+		}
+		(void)unlink(tempfile);
+		ffdpos = 0;
+	}
+	if (pwrite(ffd, name, len, ffdpos) != len) {
+		syswarn(1, errno, "Failed %s on %s",
+		    "write", "file time table");
+		return (-1);
+	}
+	*seek = -ffdpos - 1;
+	ffdpos += len;
+	return (0);
 }
 
 /*
@@ -688,12 +764,11 @@ struct slinode {
 	ino_t	sli_ino;
 	char	*sli_value;
 	struct	slpath sli_paths;
-	struct	slinode *sli_fow;		/* hash table chain */
 	dev_t	sli_dev;
 	mode_t	sli_mode;
 };
 
-static struct slinode **slitab = NULL;
+static DITAB slitab;
 
 /*
  * sltab_start()
@@ -706,7 +781,7 @@ int
 sltab_start(void)
 {
 
-	if ((slitab = calloc(SL_TAB_SZ, sizeof *slitab)) == NULL) {
+	if (dit_init(&slitab, SL_TAB_SZ) < 0) {
 		syswarn(1, errno, "symlink table");
 		return(-1);
 	}
@@ -727,8 +802,8 @@ sltab_add_sym(const char *path0, const char *value0, mode_t mode)
 	struct stat sb;
 	struct slinode *s;
 	struct slpath *p;
+	DISLOT *sp;
 	char *path, *value;
-	unsigned int indx;
 	int fd;
 
 	/* create the placeholder */
@@ -761,10 +836,8 @@ sltab_add_sym(const char *path0, const char *value0, mode_t mode)
 	}
 
 	/* now check the hash table for conflicting entry */
-	indx = (sb.st_ino ^ sb.st_dev) % SL_TAB_SZ;
-	for (s = slitab[indx]; s != NULL; s = s->sli_fow) {
-		if (s->sli_ino != sb.st_ino || s->sli_dev != sb.st_dev)
-			continue;
+	if ((sp = dit_find(&slitab, sb.st_dev, sb.st_ino)) != NULL) {
+		s = sp->ent;
 
 		/*
 		 * One of our placeholders got removed behind our back and
@@ -784,8 +857,10 @@ sltab_add_sym(const char *path0, const char *value0, mode_t mode)
 	}
 
 	/* Normal case: create a new node */
-	if ((s = malloc(sizeof *s)) == NULL) {
+	if ((s = malloc(sizeof *s)) == NULL ||
+	    dit_add(&slitab, sb.st_dev, sb.st_ino, s) < 0) {
 		syswarn(1, errno, "deferred symlink");
+		free(s);
 		unlink(path);
 		free(path);
 		free(value);
@@ -793,8 +868,6 @@ sltab_add_sym(const char *path0, const char *value0, mode_t mode)
 	}
 	s->sli_ino = sb.st_ino;
 	s->sli_dev = sb.st_dev;
-	s->sli_fow = slitab[indx];
-	slitab[indx] = s;
 
  set_value:
 	s->sli_paths.sp_path = path;
@@ -817,16 +890,14 @@ sltab_add_link(const char *path, const struct stat *sb)
 {
 	struct slinode *s;
 	struct slpath *p;
-	unsigned int indx;
+	DISLOT *sp;
 
 	if (!S_ISREG(sb->st_mode) || sb->st_size != 0)
 		return (1);
 
 	/* find the hash table entry for this hardlink */
-	indx = (sb->st_ino ^ sb->st_dev) % SL_TAB_SZ;
-	for (s = slitab[indx]; s != NULL; s = s->sli_fow) {
-		if (s->sli_ino != sb->st_ino || s->sli_dev != sb->st_dev)
-			continue;
+	if ((sp = dit_find(&slitab, sb->st_dev, sb->st_ino)) != NULL) {
+		s = sp->ent;
 
 		if ((p = malloc(sizeof *p)) == NULL) {
 			syswarn(1, errno, "%s hardlink", "deferred symlink");
@@ -945,16 +1016,16 @@ sltab_process(int in_sig)
 	struct slinode *s;
 	struct slpath *p;
 	char *first;
-	unsigned int indx;
+	size_t indx;
 
-	if (slitab == NULL)
+	if (slitab.slot == NULL)
 		return;
 
 	/* walk across the entire hash table */
-	for (indx = 0; indx < SL_TAB_SZ; indx++) {
-		while ((s = slitab[indx]) != NULL) {
-			/* pop this entry */
-			slitab[indx] = s->sli_fow;
+	for (indx = 0; indx <= slitab.mask; indx++) {
+		if ((s = slitab.slot[indx].ent) != NULL) {
+			/* pop this entry, the table is not probed any more */
+			slitab.slot[indx].ent = NULL;
 
 			first = NULL;
 			p = &s->sli_paths;
@@ -982,8 +1053,8 @@ sltab_process(int in_sig)
 		}
 	}
 	if (!in_sig)
-		free(slitab);
-	slitab = NULL;
+		free(slitab.slot);
+	slitab.slot = NULL;
 }
 
 /*
@@ -1182,9 +1253,9 @@ sub_name(char *oname, int *onamelen, int onamesize)
 int
 dev_start(void)
 {
-	if (dtab != NULL)
+	if (dtab.slot != NULL)
 		return (0);
-	if ((dtab = calloc(D_TAB_SZ, sizeof(DEVT *))) == NULL) {
+	if (dit_init(&dtab, D_TAB_SZ) < 0) {
 		paxwarn(1, "%s for %s", "Out of memory",
 		    "device mapping table");
 		return (-1);
@@ -1227,24 +1298,16 @@ static DEVT *
 chk_dev(dev_t dev, int add)
 {
 	DEVT *pt;
-	unsigned int indx;
+	DISLOT *sp;
 
-	if (dtab == NULL)
+	if (dtab.slot == NULL)
 		return(NULL);
 	/*
-	 * look to see if this device is already in the table
+	 * look to see if this device is already in the table (keyed by
+	 * the device number only); found it, return a pointer to it
 	 */
-	indx = ((unsigned)dev) % D_TAB_SZ;
-	if ((pt = dtab[indx]) != NULL) {
-		while ((pt != NULL) && (pt->dev != dev))
-			pt = pt->fow;
-
-		/*
-		 * found it, return a pointer to it
-		 */
-		if (pt != NULL)
-			return(pt);
-	}
+	if ((sp = dit_find(&dtab, dev, 0)) != NULL)
+		return(sp->ent);
 
 	/*
 	 * not in table, we add it only if told to as this may just be a check
@@ -1254,18 +1317,17 @@ chk_dev(dev_t dev, int add)
 		return(NULL);
 
 	/*
-	 * allocate a node for this device and add it to the front of the hash
-	 * chain. Note we do not assign remaps values here, so the pt->list
-	 * list must be NULL.
+	 * allocate a node for this device and add it to the table. Note we
+	 * do not assign remaps values here, so the pt->list list must be NULL.
 	 */
-	if ((pt = malloc(sizeof(DEVT))) == NULL) {
+	if ((pt = malloc(sizeof(DEVT))) == NULL ||
+	    dit_add(&dtab, dev, 0, pt) < 0) {
+		free(pt);
 		paxwarn(1, "%s for %s", "Out of memory", "device mapping table");
 		return (NULL);
 	}
 	pt->dev = dev;
 	pt->list = NULL;
-	pt->fow = dtab[indx];
-	dtab[indx] = pt;
 	return(pt);
 }
 /*
@@ -1292,7 +1354,7 @@ map_dev(ARCHD *arcn, u_long dev_mask, u_long ino_mask)
 	ino_t trunc_bits = 0;
 	ino_t nino;
 
-	if (dtab == NULL)
+	if (dtab.slot == NULL)
 		return(0);
 	/*
 	 * check for device and inode truncation, and extract the truncated
@@ -1426,9 +1488,9 @@ map_dev(ARCHD *arcn, u_long dev_mask, u_long ino_mask)
 int
 atdir_start(void)
 {
-	if (atab != NULL)
+	if (atab.slot != NULL)
 		return (0);
-	if ((atab = calloc(A_TAB_SZ, sizeof(ATDIR *))) == NULL) {
+	if (dit_init(&atab, A_TAB_SZ) < 0) {
 		paxwarn(1, "%s for %s", "Out of memory",
 		    "directory access time reset table");
 		return (-1);
@@ -1447,31 +1509,29 @@ void
 atdir_end(void)
 {
 	ATDIR *pt;
-	int i;
+	size_t i;
 
-	if (atab == NULL)
+	if (atab.slot == NULL)
 		return;
 	/*
-	 * for each non-empty hash table entry reset all the directories
-	 * chained there.
+	 * for each used hash table slot reset the directory stored there.
 	 */
-	for (i = 0; i < A_TAB_SZ; ++i) {
-		if ((pt = atab[i]) == NULL)
+	for (i = 0; i <= atab.mask; ++i) {
+		if ((pt = atab.slot[i].ent) == NULL)
 			continue;
 		/*
 		 * remember to force the times, set_ftime() looks at pmtime
 		 * and patime, which only applies to things CREATED by pax,
 		 * not read by pax. Read time reset is controlled by -t.
 		 */
-		for (; pt != NULL; pt = pt->fow)
-			set_attr(&pt->ft, 1, 0, 0, 0);
+		set_attr(&pt->ft, 1, 0, 0, 0);
 	}
 }
 
 /*
  * add_atdir()
  *	add a directory to the directory access time table. Table is hashed
- *	and chained by inode number. This is for directories READ by pax
+ *	by inode and device number. This is for directories READ by pax
  */
 
 void
@@ -1479,9 +1539,8 @@ add_atdir(const char *fname, const struct stat *sbp)
 {
 	ATDIR *pt;
 	sigset_t allsigs, savedsigs;
-	unsigned int indx;
 
-	if (atab == NULL)
+	if (atab.slot == NULL)
 		return;
 
 	/*
@@ -1491,36 +1550,27 @@ add_atdir(const char *fname, const struct stat *sbp)
 	 * different args to pax and the -n option is aborting fts out of a
 	 * subtree before all the post-order visits have been made.
 	 */
-	indx = ((unsigned)sbp->st_ino) % A_TAB_SZ;
-	if ((pt = atab[indx]) != NULL) {
-		while (pt != NULL) {
-			if ((pt->ft.ft_ino == sbp->st_ino) && (pt->ft.ft_dev == sbp->st_dev))
-				break;
-			pt = pt->fow;
-		}
-
-		/*
-		 * oops, already there. Leave it alone.
-		 */
-		if (pt != NULL)
-			return;
-	}
+	if (dit_find(&atab, sbp->st_dev, sbp->st_ino) != NULL)
+		return;
 
 	/*
-	 * add it to the front of the hash chain
+	 * add it to the table
 	 */
 	sigfillset(&allsigs);
 	sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
 	if ((pt = malloc(sizeof *pt)) != NULL) {
 		if ((pt->ft.ft_name = strdup(fname)) != NULL) {
+			pt->ft.ft_dirfd = -1;
 			pt->ft.ft_dev = sbp->st_dev;
 			pt->ft.ft_ino = sbp->st_ino;
 			st_timecpy(m, &pt->ft.sb, sbp);
 			st_timecpy(a, &pt->ft.sb, sbp);
-			pt->fow = atab[indx];
-			atab[indx] = pt;
-			sigprocmask(SIG_SETMASK, &savedsigs, NULL);
-			return;
+			if (dit_add(&atab, sbp->st_dev, sbp->st_ino,
+			    pt) == 0) {
+				sigprocmask(SIG_SETMASK, &savedsigs, NULL);
+				return;
+			}
+			free(pt->ft.ft_name);
 		}
 		free(pt);
 	}
@@ -1544,34 +1594,19 @@ int
 do_atdir(const char *name, dev_t dev, ino_t ino)
 {
 	ATDIR *pt;
-	ATDIR **ppt;
+	DISLOT *sp;
 	sigset_t allsigs, savedsigs;
-	unsigned int indx;
 
-	if (atab == NULL)
+	if (atab.slot == NULL)
 		return(-1);
 	/*
-	 * hash by inode and search the chain for an inode and device match
+	 * hash by inode and device and look for a match, return if we
+	 * did not find it.
 	 */
-	indx = ((unsigned)ino) % A_TAB_SZ;
-	if ((pt = atab[indx]) == NULL)
+	if ((sp = dit_find(&atab, dev, ino)) == NULL)
 		return(-1);
-
-	ppt = &(atab[indx]);
-	while (pt != NULL) {
-		if ((pt->ft.ft_ino == ino) && (pt->ft.ft_dev == dev))
-			break;
-		/*
-		 * no match, go to next one
-		 */
-		ppt = &(pt->fow);
-		pt = pt->fow;
-	}
-
-	/*
-	 * return if we did not find it.
-	 */
-	if (pt == NULL || pt->ft.ft_name == NULL ||
+	pt = sp->ent;
+	if (pt->ft.ft_name == NULL ||
 	    strcmp(name, pt->ft.ft_name) == 0)
 		return(-1);
 
@@ -1581,7 +1616,7 @@ do_atdir(const char *name, dev_t dev, ino_t ino)
 	set_attr(&pt->ft, 1, 0, 0, 0);
 	sigfillset(&allsigs);
 	sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
-	*ppt = pt->fow;
+	dit_del(&atab, sp);
 	sigprocmask(SIG_SETMASK, &savedsigs, NULL);
 	free(pt->ft.ft_name);
 	free(pt);
@@ -1604,7 +1639,10 @@ do_atdir(const char *name, dev_t dev, ino_t ino)
  * files have been extracted (or copied), these directories have their times
  * and file modes reset to the stored values. The directory info is restored in
  * reverse order as entries were added from root to leaf: to restore atime
- * properly, we must go backwards.
+ * properly, we must go backwards. When pax changes directories during the
+ * extraction, relative names are stored together with a descriptor of the
+ * directory they were created in (if the system has openat), instead of
+ * being canonicalised with realpath().
  */
 
 /*
@@ -1621,8 +1659,11 @@ dir_start(void)
 	if (dirp != NULL)
 		return(0);
 
-	dirsize = DIRP_SIZE;
-	if ((dirp = reallocarray(NULL, dirsize, sizeof(DIRDATA))) == NULL) {
+	dirsize = 16;
+	if ((dirp = reallocarray(NULL, dirsize, sizeof(DIRDATA *))) == NULL ||
+	    dit_init(&dirtab, DIRP_TAB_SZ) < 0) {
+		free(dirp);
+		dirp = NULL;
 		paxwarn(1, "%s for %s", "Out of memory",
 		    "directory times");
 		return (-1);
@@ -1630,6 +1671,44 @@ dir_start(void)
 	return(0);
 }
 
+#if HAVE_OPENAT
+/*
+ * dir_cwdfd()
+ *	return a descriptor for the current directory, which stays open
+ *	until proc_dir(); the descriptors are cached by device and inode
+ *	number, as pax only visits a few directories (the -C arguments)
+ * Return:
+ *	the descriptor, -1 on failure
+ */
+
+static int
+dir_cwdfd(void)
+{
+	struct stat sb;
+	struct dirfds *dfp;
+	size_t i;
+	int fd;
+
+	if (stat(".", &sb) < 0)
+		return (-1);
+	for (i = 0; i < ndirfds; ++i)
+		if ((dirfds[i].ino == sb.st_ino) &&
+		    (dirfds[i].dev == sb.st_dev))
+			return (dirfds[i].fd);
+	if ((dfp = reallocarray(dirfds, ndirfds + 1,
+	    sizeof(struct dirfds))) == NULL)
+		return (-1);
+	dirfds = dfp;
+	if ((fd = binopen2(BO_CLEXEC | BO_MAYBE_DIR, ".", O_RDONLY)) < 0)
+		return (-1);
+	dirfds[ndirfds].dev = sb.st_dev;
+	dirfds[ndirfds].ino = sb.st_ino;
+	dirfds[ndirfds].fd = fd;
+	++ndirfds;
+	return (fd);
+}
+#endif
+
 /*
  * add_dir()
  *	add the mode and times for a newly CREATED directory
@@ -1647,13 +1726,25 @@ void
 add_dir(char *name, struct stat *psb, int frc_mode)
 {
 	DIRDATA *dblk;
+	DIRDATA **dpp;
+	DIRDATA *chunk = NULL;
+	DISLOT *sp;
 	sigset_t allsigs, savedsigs;
+	int dfd = -1;
+#if !HAVE_OPENAT
 	char *rp = NULL;
+#endif
 
 	if (dirp == NULL)
 		return;
 
 	if (havechd && *name != '/') {
+#if HAVE_OPENAT
+		if ((dfd = dir_cwdfd()) == -1) {
+			syswarn(1, errno, "Cannot open directory of %s", name);
+			return;
+		}
+#else
 #ifdef REALPATH_CAN_ALLOCATE
 		if ((rp = realpath(name, NULL)) == NULL)
 #else
@@ -1664,31 +1755,43 @@ add_dir(char *name, struct stat *psb, int frc_mode)
 			return;
 		}
 		name = rp;
-	}
-	if (dircnt == dirsize) {
-		dblk = reallocarray(dirp, dirsize * 2, sizeof(DIRDATA));
-		if (dblk == NULL) {
-			paxwarn(1, "Unable to store mode and times for created"
-			    " directory %s", name);
-#ifdef REALPATH_CAN_ALLOCATE
-			free(rp);
 #endif
-			return;
+	}
+	sigfillset(&allsigs);
+	if ((dircnt % DIRP_CHUNK) == 0) {
+		/*
+		 * start a new chunk, growing the chunk pointers if needed
+		 */
+		if (dircnt / DIRP_CHUNK == dirsize) {
+			dpp = reallocarray(dirp, dirsize * 2,
+			    sizeof(DIRDATA *));
+			if (dpp == NULL)
+				goto nomem;
+			sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
+			dirp = dpp;
+			dirsize *= 2;
+			sigprocmask(SIG_SETMASK, &savedsigs, NULL);
 		}
-		sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
-		dirp = dblk;
-		dirsize *= 2;
-		sigprocmask(SIG_SETMASK, &savedsigs, NULL);
-	}
-	dblk = &dirp[dircnt];
-	if ((dblk->ft.ft_name = strdup(name)) == NULL) {
-		paxwarn(1, "Unable to store mode and times for created"
-		    " directory %s", name);
-#ifdef REALPATH_CAN_ALLOCATE
-		free(rp);
-#endif
-		return;
+		if ((chunk = reallocarray(NULL, DIRP_CHUNK,
+		    sizeof(DIRDATA))) == NULL)
+			goto nomem;
+		dirp[dircnt / DIRP_CHUNK] = chunk;
 	}
+	dblk = &dirp[dircnt / DIRP_CHUNK][dircnt % DIRP_CHUNK];
+	if ((dblk->ft.ft_name = strdup(name)) == NULL)
+		goto nomem;
+
+	/*
+	 * index by dev/ino; should a removed directory's inode have been
+	 * reused, the newer entry is the one delete_dir() finds
+	 */
+	if ((sp = dit_find(&dirtab, psb->st_dev, psb->st_ino)) != NULL)
+		sp->ent = dblk;
+	else if (dit_add(&dirtab, psb->st_dev, psb->st_ino, dblk) < 0) {
+		free(dblk->ft.ft_name);
+		goto nomem;
+	}
+	dblk->ft.ft_dirfd = dfd;
 	st_timecpy(m, &dblk->ft.sb, psb);
 	st_timecpy(a, &dblk->ft.sb, psb);
 	dblk->ft.ft_ino = psb->st_ino;
@@ -1698,7 +1801,17 @@ add_dir(char *name, struct stat *psb, int frc_mode)
 	sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
 	++dircnt;
 	sigprocmask(SIG_SETMASK, &savedsigs, NULL);
-#ifdef REALPATH_CAN_ALLOCATE
+#if !HAVE_OPENAT && defined(REALPATH_CAN_ALLOCATE)
+	free(rp);
+#endif
+	return;
+
+ nomem:
+	/* the next call starts this chunk again */
+	free(chunk);
+	paxwarn(1, "Unable to store mode and times for created"
+	    " directory %s", name);
+#if !HAVE_OPENAT && defined(REALPATH_CAN_ALLOCATE)
 	free(rp);
 #endif
 }
@@ -1713,23 +1826,16 @@ void
 delete_dir(dev_t dev, ino_t ino)
 {
 	DIRDATA *dblk;
+	DISLOT *sp;
 	char *name;
-	size_t i;
 
-	if (dirp == NULL)
+	if ((dirp == NULL) || ((sp = dit_find(&dirtab, dev, ino)) == NULL))
 		return;
-	for (i = 0; i < dircnt; i++) {
-		dblk = &dirp[i];
-
-		if (dblk->ft.ft_name == NULL)
-			continue;
-		if (dblk->ft.ft_dev == dev && dblk->ft.ft_ino == ino) {
-			name = dblk->ft.ft_name;
-			dblk->ft.ft_name = NULL;
-			free(name);
-			break;
-		}
-	}
+	dblk = sp->ent;
+	dit_del(&dirtab, sp);
+	name = dblk->ft.ft_name;
+	dblk->ft.ft_name = NULL;
+	free(name);
 }
 
 /*
@@ -1752,7 +1858,7 @@ proc_dir(int in_sig)
 	 */
 	cnt = dircnt;
 	while (cnt-- > 0) {
-		dblk = &dirp[cnt];
+		dblk = &dirp[cnt / DIRP_CHUNK][cnt % DIRP_CHUNK];
 		/*
 		 * If we remove a directory we created, we replace the
 		 * ft_name with NULL.  Ignore those.
@@ -1770,8 +1876,20 @@ proc_dir(int in_sig)
 			free(dblk->ft.ft_name);
 	}
 
-	if (!in_sig)
+	if (!in_sig) {
+		for (cnt = 0; cnt < (dircnt + DIRP_CHUNK - 1) / DIRP_CHUNK;
+		    ++cnt)
+			free(dirp[cnt]);
 		free(dirp);
+		free(dirtab.slot);
+#if HAVE_OPENAT
+		for (cnt = 0; cnt < ndirfds; ++cnt)
+			close(dirfds[cnt].fd);
+		free(dirfds);
+		dirfds = NULL;
+		ndirfds = 0;
+#endif
+	}
 	dirp = NULL;
 	dircnt = 0;
 }
@@ -1780,6 +1898,150 @@ proc_dir(int in_sig)
  * database independent routines
  */
 
+/*
+ * dit_hash()
+ *	hashes a device and inode number pair for the open addressed tables.
+ *	Both are folded to 32 bits and combined, then mixed (the finaliser
+ *	of MurmurHash3), as inode numbers are often sequential and most of
+ *	the entries share the same device number.
+ * Return:
+ *	the hash value (to be masked to the table size)
+ */
+
+static unsigned int
+dit_hash(dev_t dev, ino_t ino)
+{
+	unsigned int h;
+
+	h = (unsigned int)ino ^ (unsigned int)((ino >> 16) >> 16);
+	h ^= ((unsigned int)dev ^ (unsigned int)((dev >> 16) >> 16)) *
+	    0x9E3779B9U;
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	h ^= h >> 16;
+	return (h);
+}
+
+/*
+ * dit_init()
+ *	create an empty device and inode keyed table of sz (2^n) slots
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+static int
+dit_init(DITAB *t, size_t sz)
+{
+	if ((t->slot = calloc(sz, sizeof(DISLOT))) == NULL)
+		return (-1);
+	t->mask = sz - 1;
+	t->cnt = 0;
+	return (0);
+}
+
+/*
+ * dit_probe()
+ *	walk the slots from the home position of dev/ino until either the
+ *	slot with this key or a free one is found
+ * Return:
+ *	pointer to that slot
+ */
+
+static DISLOT *
+dit_probe(DISLOT *slot, size_t mask, dev_t dev, ino_t ino)
+{
+	size_t i;
+
+	for (i = dit_hash(dev, ino) & mask; slot[i].ent != NULL;
+	    i = (i + 1) & mask)
+		if ((slot[i].ino == ino) && (slot[i].dev == dev))
+			break;
+	return (&slot[i]);
+}
+
+/*
+ * dit_find()
+ *	look up dev/ino in a table
+ * Return:
+ *	pointer to the slot holding the entry, NULL if not in the table
+ */
+
+static DISLOT *
+dit_find(DITAB *t, dev_t dev, ino_t ino)
+{
+	DISLOT *sp;
+
+	sp = dit_probe(t->slot, t->mask, dev, ino);
+	return (sp->ent == NULL ? NULL : sp);
+}
+
+/*
+ * dit_add()
+ *	add the entry ent (not already in there) for dev/ino to a table,
+ *	doubling the table first if it would become more than three
+ *	quarters full. The new slots are set up before the old ones are
+ *	freed, as the tables may be walked by signal cleanup code.
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+static int
+dit_add(DITAB *t, dev_t dev, ino_t ino, void *ent)
+{
+	DISLOT *ns, *os, *sp;
+	size_t i, nmask;
+
+	if (t->cnt + 1 > (t->mask + 1) / 4 * 3) {
+		nmask = t->mask * 2 + 1;
+		if ((ns = calloc(nmask + 1, sizeof(DISLOT))) == NULL)
+			return (-1);
+		for (i = 0; i <= t->mask; ++i)
+			if (t->slot[i].ent != NULL)
+				*dit_probe(ns, nmask, t->slot[i].dev,
+				    t->slot[i].ino) = t->slot[i];
+		os = t->slot;
+		t->slot = ns;
+		t->mask = nmask;
+		free(os);
+	}
+	sp = dit_probe(t->slot, t->mask, dev, ino);
+	sp->dev = dev;
+	sp->ino = ino;
+	sp->ent = ent;
+	++t->cnt;
+	return (0);
+}
+
+/*
+ * dit_del()
+ *	remove the entry in slot sp from a table, moving back the entries
+ *	after it in the probe sequence which may no longer be found
+ *	otherwise (the caller frees the entry itself)
+ */
+
+static void
+dit_del(DITAB *t, DISLOT *sp)
+{
+	size_t i, j, k;
+
+	i = j = sp - t->slot;
+	for (;;) {
+		j = (j + 1) & t->mask;
+		if (t->slot[j].ent == NULL)
+			break;
+		/* the entry at j may stay if its home k is cyclically in (i, j] */
+		k = dit_hash(t->slot[j].dev, t->slot[j].ino) & t->mask;
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+			continue;
+		t->slot[i] = t->slot[j];
+		i = j;
+	}
+	t->slot[i].ent = NULL;
+	--t->cnt;
+}
+
 /*
  * st_hash()
  *	hashes filenames to an unsigned int for hashing into a table. It looks
@@ -1867,9 +2129,9 @@ st_hash(const char *name, int len, int tabsz)
 int
 flnk_start(void)
 {
-	if (fltab != NULL)
+	if (fltab.slot != NULL)
 		return (0);
-	if ((fltab = (HRDFLNK **)calloc(L_TAB_SZ, sizeof(HRDFLNK *))) == NULL) {
+	if (dit_init(&fltab, L_TAB_SZ) < 0) {
 		paxwarn(1, "%s for %s", "Out of memory",
 		    "hard link anonymisation table");
 		return (-1);
@@ -1893,11 +2155,10 @@ int
 chk_flnk(ARCHD *arcn)
 {
 	HRDFLNK *pt;
-	HRDFLNK **ppt;
-	unsigned int indx;
+	DISLOT *sp;
 	static ino_t running = 3;
 
-	if (fltab == NULL)
+	if (fltab.slot == NULL)
 		return (-1);
 	/*
 	 * ignore those nodes that cannot have hard links
@@ -1906,53 +2167,593 @@ chk_flnk(ARCHD *arcn)
 		return (running++);
 
 	/*
-	 * hash inode number and look for this file
+	 * hash inode and device number and look for this file
 	 */
-	indx = ((unsigned)arcn->sb.st_ino) % L_TAB_SZ;
-	if ((pt = fltab[indx]) != NULL) {
+	if ((sp = dit_find(&fltab, arcn->sb.st_dev, arcn->sb.st_ino)) != NULL) {
+		/* found a link */
+		ino_t rv;
+
+		pt = sp->ent;
+		rv = pt->newi;
+		/* so cpio doesn't write file data twice */
+		arcn->type |= PAX_LINKOR;
 		/*
-		 * it's hash chain in not empty, walk down looking for it
+		 * if we have found all the links to this file, remove
+		 * it from the database
 		 */
-		ppt = &(fltab[indx]);
-		while (pt != NULL) {
-			if ((pt->ino == arcn->sb.st_ino) &&
-			    (pt->dev == arcn->sb.st_dev))
-				break;
-			ppt = &(pt->fow);
-			pt = pt->fow;
-		}
-
-		if (pt != NULL) {
-			/* found a link */
-			ino_t rv = pt->newi;
-			/* so cpio doesn't write file data twice */
-			arcn->type |= PAX_LINKOR;
-			/*
-			 * if we have found all the links to this file, remove
-			 * it from the database
-			 */
-			if (--pt->nlink <= 1) {
-				*ppt = pt->fow;
-				(void)free((char *)pt);
-			}
-			return (rv);
+		if (--pt->nlink <= 1) {
+			dit_del(&fltab, sp);
+			free(pt);
 		}
+		return (rv);
 	}
 
 	/*
 	 * we never saw this file before. It has links so we add it to the
-	 * front of this hash chain
+	 * table
 	 */
-	if ((pt = (HRDFLNK *)malloc(sizeof(HRDFLNK))) != NULL) {
-		pt->dev = arcn->sb.st_dev;
-		pt->ino = arcn->sb.st_ino;
+	if ((pt = malloc(sizeof(HRDFLNK))) != NULL) {
 		pt->nlink = arcn->sb.st_nlink;
-		pt->fow = fltab[indx];
 		pt->newi = running++;
-		fltab[indx] = pt;
-		return (pt->newi);
+		if (dit_add(&fltab, arcn->sb.st_dev, arcn->sb.st_ino, pt) == 0)
+			return (pt->newi);
+		free(pt);
 	}
 
 	paxwarn(1, "%s for %s", "Out of memory", "hard link anonymisation table");
 	return (-1);
 }
+
+/*
+ * Member index routines. While writing an archive, the name, header
+ * offset, size, type and mtime of every member can be stored into a
+ * sidecar file (-o index=file). When reading a single volume archive
+ * for members named by plain pathnames, the index is used to skip
+ * straight from one wanted member to the next (which ar_fow() can do
+ * quickly for archive files) and to stop after the last one.
+ * The file starts with "paxidx 1 <format>" and has one record per
+ * member, "<offset> <size> <type> <mtime> <name>", each of these
+ * terminated by a NUL byte; the size is that of the file data archived
+ * and the type the ls(1) mode letter, or h for a hard link. An index
+ * can also be made by listing an existing archive (-o index.scan=file),
+ * see idx_scan().
+ */
+
+#define IDXWRKMAX	64		/* most index scan workers */
+#define IDXRGNMIN	(16 * 1048576)	/* least archive bytes per worker */
+#define IDXSCANSZ	65536		/* read size when seeking a header */
+/* start of region i of the n idx_scan() cuts an archive of sz bytes into */
+#define IDXRGN(sz,n,i)	((i) == (n) ? (sz) : \
+			    (sz) / (n) * (i) / BLKMULT * BLKMULT)
+
+const char *idxname;			/* member index file, if any */
+const char *idxscan;			/* member index to make by listing */
+int idxthreads;				/* index scan workers, 0 = auto */
+static FILE *idxfp;			/* index being written */
+static off_t *idxoff;			/* offsets of the wanted members */
+static size_t nidxoff;			/* number of wanted members */
+static size_t idxcur;			/* next wanted member */
+static char idxon;			/* index used on read: 0 no, 1 yes */
+static char idxfirst;			/* no header was read yet */
+static char idxend;			/* index ended the read early */
+
+/*
+ * idx_wr_start()
+ *	create the member index when writing an archive (not on append,
+ *	as the members already in the archive would be missing)
+ * Return:
+ *	0 if ok (or no index wanted), -1 on failure
+ */
+
+int
+idx_wr_start(int is_app)
+{
+	if (idxname == NULL)
+		return (0);
+	if (is_app) {
+		paxwarn(0, "Cannot add to member index %s, ignoring it",
+		    idxname);
+		return (0);
+	}
+	if ((idxfp = fopen(idxname, "w")) == NULL) {
+		syswarn(1, errno, "Unable to create member index %s", idxname);
+		return (-1);
+	}
+	fprintf(idxfp, "paxidx 1 %s", frmt->name);
+	putc('\0', idxfp);
+	return (0);
+}
+
+/*
+ * idx_wr_add()
+ *	add the member arcn, whose headers start at offset off in the
+ *	archive, to the member index
+ */
+
+void
+idx_wr_add(ARCHD *arcn, off_t off)
+{
+	if (idxfp == NULL)
+		return;
+	idx_put(off, arcn->sb.st_size, arcn->type,
+	    (long long)arcn->sb.st_mtime, arcn->name);
+}
+
+/*
+ * idx_put()
+ *	write one record to the member index; only regular files have
+ *	data (their real size if they are sparse), and the type is put
+ *	as a letter so the index does not depend on pax internals
+ */
+
+static void
+idx_put(off_t off, off_t size, int type, long long mtime, const char *name)
+{
+	int tc;
+
+	switch (type) {
+	case PAX_DIR:
+		tc = 'd';
+		break;
+	case PAX_CHR:
+		tc = 'c';
+		break;
+	case PAX_BLK:
+		tc = 'b';
+		break;
+	case PAX_SLK:
+		tc = 'l';
+		break;
+	case PAX_SCK:
+		tc = 's';
+		break;
+	case PAX_FIF:
+		tc = 'p';
+		break;
+	case PAX_HLK:
+	case PAX_HRG:
+		tc = 'h';
+		break;
+	default:
+		tc = '-';
+		break;
+	}
+	if (!PAX_IS_REG(type))
+		size = 0;
+	fprintf(idxfp, "%" OT_FMT " %" OT_FMT " %c %lld %s", off, size, tc,
+	    mtime, name);
+	putc('\0', idxfp);
+}
+
+/*
+ * idx_wr_end()
+ *	finish the member index
+ */
+
+void
+idx_wr_end(void)
+{
+	if (idxfp == NULL)
+		return;
+	if (ferror(idxfp) | fclose(idxfp))
+		syswarn(1, errno, "Failed write to member index %s",
+		    idxscan != NULL ? idxscan : idxname);
+	idxfp = NULL;
+}
+
+/*
+ * idx_rd_start()
+ *	load the offsets of the members which may match the patterns from
+ *	the member index; the archive format must be known already
+ * Return:
+ *	0 if ok (whether or not the index is used), -1 on failure
+ */
+
+int
+idx_rd_start(void)
+{
+	struct stat sb;
+	char *buf, *rec, *name, *ep;
+	size_t len;
+	ssize_t res;
+	off_t off, *p;
+	int fd, fld;
+
+	if (idxname == NULL)
+		return (0);
+	if (!pat_lit()) {
+		paxwarn(0, "Member index %s needs plain pathnames, ignoring it",
+		    idxname);
+		return (0);
+	}
+	if ((fd = open(idxname, O_RDONLY)) < 0) {
+		syswarn(1, errno, "Unable to open member index %s", idxname);
+		return (-1);
+	}
+	if ((fstat(fd, &sb) < 0) || ((buf = malloc(sb.st_size + 1)) == NULL)) {
+		syswarn(1, errno, "Unable to read member index %s", idxname);
+		(void)close(fd);
+		return (-1);
+	}
+	for (len = 0; len < (size_t)sb.st_size; len += res)
+		if ((res = read(fd, buf + len, sb.st_size - len)) <= 0)
+			break;
+	(void)close(fd);
+	buf[len] = '\0';
+
+	len = strlen(buf);
+	if ((len < 9) || strncmp(buf, "paxidx 1 ", 9) ||
+	    strcmp(buf + 9, frmt->name))
+		goto bad;
+	nidxoff = 0;
+	for (rec = buf + len + 1; rec < buf + sb.st_size; rec += len + 1) {
+		len = strlen(rec);
+		off = (off_t)strtoll(rec, &ep, 10);
+		if ((ep == rec) || (*ep != ' ') || (off < 0) ||
+		    ((nidxoff > 0) && (off <= idxoff[nidxoff - 1])))
+			goto bad;
+		/* skip size, type and mtime */
+		for (name = ep, fld = 0; fld < 4; ++fld)
+			if ((name = strchr(name, ' ')) == NULL)
+				goto bad;
+			else
+				++name;
+		if (!pat_cand(name, len - (name - rec)))
+			continue;
+		if ((nidxoff % 1024) == 0) {
+			if ((p = reallocarray(idxoff, nidxoff + 1024,
+			    sizeof(off_t))) == NULL) {
+				paxwarn(1, "%s for %s", "Out of memory",
+				    "member index");
+				free(buf);
+				return (-1);
+			}
+			idxoff = p;
+		}
+		idxoff[nidxoff++] = off;
+	}
+	free(buf);
+	idxcur = 0;
+	idxon = idxfirst = 1;
+	return (0);
+
+ bad:
+	paxwarn(0, "%s is no member index for this %s archive, ignoring it",
+	    idxname, frmt->name);
+	free(buf);
+	return (0);
+}
+
+/*
+ * idx_skip()
+ *	called before reading the next header: move forward to the next
+ *	member wanted according to the member index. arcn holds the member
+ *	read last; a GNU long name is still followed by its real header.
+ * Return:
+ *	0 to go on reading, 1 if there are no more wanted members (or the
+ *	archive ended), -1 on error
+ */
+
+int
+idx_skip(ARCHD *arcn)
+{
+	off_t cur;
+
+	if (!idxon)
+		return (0);
+	if (!idxfirst && ((arcn->type == PAX_GLL) || (arcn->type == PAX_GLF)))
+		return (0);
+	idxfirst = 0;
+	cur = rd_pos();
+	while ((idxcur < nidxoff) && (idxoff[idxcur] < cur))
+		++idxcur;
+	if (idxcur == nidxoff) {
+		idxend = 1;
+		return (1);
+	}
+	if (idxoff[idxcur] == cur)
+		return (0);
+	return (rd_skip(idxoff[idxcur] - cur));
+}
+
+/*
+ * idx_done()
+ *	tell whether the member index made us stop before the archive end
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+idx_done(void)
+{
+	return (idxend);
+}
+
+/*
+ * idx_scan()
+ *	start making the member index given with -o index.scan while
+ *	listing. For a ustar archive in a file or on a disc, of which all
+ *	members are wanted, this is done here at once: the volume is cut
+ *	into regions, a worker process per region looks for the first
+ *	block passing for a header in it and follows the chain of headers
+ *	from there, and then the chains are stitched together from the
+ *	start of the archive. A chain which was started on file data that
+ *	looked like a header is not taken; the headers are followed here
+ *	instead until they meet the chain of the worker. Otherwise list()
+ *	adds the members it would list with idx_wr_add().
+ * Return:
+ *	0 if list() should go on, 1 if the index is complete, -1 on error
+ */
+
+int
+idx_scan(void)
+{
+	pid_t pid[IDXWRKMAX];
+	int fd[IDXWRKMAX];
+	off_t size;
+	long hdlen;
+	int i, n, res;
+
+	if (idxscan == NULL)
+		return (0);
+	if (idxname != NULL) {
+		paxwarn(1, "Cannot use a member index while making one");
+		return (-1);
+	}
+	if ((idxfp = fopen(idxscan, "w")) == NULL) {
+		syswarn(1, errno, "Unable to create member index %s", idxscan);
+		return (-1);
+	}
+	fprintf(idxfp, "paxidx 1 %s", frmt->name);
+	putc('\0', idxfp);
+	hdlen = ftell(idxfp);
+
+	/*
+	 * anything else is left to list(), which reads one header after
+	 * the other
+	 */
+	if (strcmp(frmt->name, "ustar") || !ar_seekable() || !pat_none() ||
+	    !sel_none() || ((size = ar_size()) <= 0))
+		return (0);
+	n = idxthreads;
+#ifdef _SC_NPROCESSORS_ONLN
+	if (n == 0)
+		n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (n > IDXWRKMAX)
+		n = IDXWRKMAX;
+	if (n > size / IDXRGNMIN)
+		n = size / IDXRGNMIN;
+	if (n < 2)
+		return (0);
+
+	for (i = 0; i < n; ++i) {
+		memcpy(tempbase, _TFILE_BASE, sizeof(_TFILE_BASE));
+		if ((fd[i] = mkstemp(tempfile)) < 0)
+			break;
+		(void)unlink(tempfile);
+		if ((pid[i] = fork()) < 0) {
+			(void)close(fd[i]);
+			break;
+		}
+		if (pid[i] == 0)
+			idx_scanwrk(IDXRGN(size, n, i), IDXRGN(size, n, i + 1),
+			    fd[i]);
+	}
+	if (i < n) {
+		syswarn(0, errno, "Cannot start %s workers, using one",
+		    "index.scan");
+		n = i;
+		res = 0;
+	} else if ((res = idx_join(size, n, pid, fd)) == 0) {
+		/* start over */
+		if ((fflush(idxfp) != 0) ||
+		    (fseek(idxfp, hdlen, SEEK_SET) != 0) ||
+		    (ftruncate(fileno(idxfp), hdlen) != 0)) {
+			syswarn(1, errno, "Failed write to member index %s",
+			    idxscan);
+			res = -1;
+		}
+	}
+
+	/* workers still running if the archive ended early */
+	for (i = 0; i < n; ++i) {
+		if (pid[i] > 0) {
+			(void)kill(pid[i], SIGTERM);
+			(void)waitpid(pid[i], NULL, 0);
+		}
+		if (fd[i] >= 0)
+			(void)close(fd[i]);
+	}
+	return (res);
+}
+
+/*
+ * idx_join()
+ *	stitch the chains of headers found by the idx_scan() workers: the
+ *	chain from the start of the archive is the right one; in each
+ *	region, follow it until it reaches a header on the chain of the
+ *	worker, from which on both are the same, and write the members
+ *	to the index. The workers are waited for (and their files closed)
+ *	in turn; pid and fd entries done with are set to -1.
+ * Return:
+ *	1 if the index is complete, 0 if the archive must be read in turn,
+ *	-1 on error
+ */
+
+static int
+idx_join(off_t size, int n, pid_t *pid, int *fd)
+{
+	IDXHD *ih, *hp, *rp;
+	FILE *fp;
+	char pname[PAXPATHLEN + 1], blk[BLKMULT], *name;
+	off_t hi, cur, first, psize, last;
+	int i, have, pnlen;
+
+	if ((ih = malloc(2 * sizeof(IDXHD))) == NULL) {
+		paxwarn(1, "%s for %s", "Out of memory", "member index");
+		return (-1);
+	}
+	rp = ih + 1;
+	cur = 0;
+	first = psize = last = -1;
+	pnlen = 0;
+	for (i = 0; i < n; ++i) {
+		hi = IDXRGN(size, n, i + 1);
+		(void)waitpid(pid[i], NULL, 0);
+		pid[i] = -1;
+		if ((lseek(fd[i], 0, SEEK_SET) < 0) ||
+		    ((fp = fdopen(fd[i], "r")) == NULL)) {
+			syswarn(1, errno, "Unable to read %s results",
+			    "index.scan");
+			free(ih);
+			return (-1);
+		}
+		fd[i] = -1;
+		have = idx_hdrd(fp, rp);
+		while (cur < hi) {
+			while (have && (rp->off < cur))
+				have = idx_hdrd(fp, rp);
+			if (have && (rp->off == cur))
+				hp = rp;
+			else if (ustar_hdinfo(cur, ih) < 0)
+				break;
+			else
+				hp = ih;
+
+			if (hp->type == PAX_GLF) {
+				/* belongs to the next member */
+				if (first < 0)
+					first = hp->off;
+				if (hp->nlen > 0)
+					pnlen = strlcpy(pname, hp->name,
+					    sizeof(pname));
+				if (hp->size >= 0)
+					psize = hp->size;
+			} else {
+				if (pnlen == 0) {
+					name = hp->name;
+					pnlen = hp->nlen;
+				} else
+					name = pname;
+				/* as ustar_rd() does */
+				if ((hp->type == PAX_DIR) && (pnlen > 1) &&
+				    (name[pnlen - 1] == '/'))
+					name[pnlen - 1] = '\0';
+				idx_put(first < 0 ? hp->off : first,
+				    psize < 0 ? hp->size : psize, hp->type,
+				    hp->mtime, name);
+				first = psize = -1;
+				pnlen = 0;
+			}
+			last = cur;
+			cur = hp->next;
+			if (hp == rp)
+				have = idx_hdrd(fp, rp);
+		}
+		(void)fclose(fp);
+		if (cur < hi)
+			break;
+	}
+	free(ih);
+
+	/*
+	 * the archive must end with a NUL block in this volume, or else
+	 * there is more to it than the scan can tell (a corrupt header or
+	 * a next volume), which the normal listing will deal with
+	 */
+	if ((cur < size) && (first < 0) &&
+	    (ar_pread(blk, BLKMULT, cur) == BLKMULT) && (blk[0] == '\0') &&
+	    !memcmp(blk, blk + 1, BLKMULT - 1))
+		return (1);
+	if (cur > size)
+		paxwarn(0, "%s is truncated after the header at offset %"
+		    OT_FMT ", reading it", arcname, last);
+	else
+		paxwarn(0, "Cannot scan %s past offset %" OT_FMT
+		    ", reading it", arcname, cur);
+	return (0);
+}
+
+/*
+ * idx_scanwrk()
+ *	worker of idx_scan() for the region from lo up to hi: write the
+ *	chain of headers starting at the first block which passes for a
+ *	ustar header in it to the file fd
+ */
+
+static void
+idx_scanwrk(off_t lo, off_t hi, int fd)
+{
+	IDXHD *ih;
+	FILE *fp;
+	char *buf;
+	off_t off;
+	ssize_t cnt, i;
+
+	(void)signal(SIGHUP, SIG_DFL);
+	(void)signal(SIGINT, SIG_DFL);
+	(void)signal(SIGQUIT, SIG_DFL);
+	(void)signal(SIGTERM, SIG_DFL);
+	(void)signal(SIGXCPU, SIG_DFL);
+	(void)signal(SIGPIPE, SIG_DFL);
+
+	if (((buf = malloc(IDXSCANSZ)) == NULL) ||
+	    ((ih = malloc(sizeof(IDXHD))) == NULL) ||
+	    ((fp = fdopen(fd, "w")) == NULL))
+		_exit(1);
+
+	for (off = lo; off < hi; off += cnt) {
+		if ((cnt = ar_pread(buf, MINIMUM(IDXSCANSZ, hi - off),
+		    off)) < BLKMULT)
+			_exit(cnt < 0);
+		cnt -= cnt % BLKMULT;
+		for (i = 0; i < cnt; i += BLKMULT)
+			if (ustar_id(buf + i, BLKMULT) == 0)
+				break;
+		if (i < cnt) {
+			off += i;
+			break;
+		}
+	}
+	while ((off < hi) && (ustar_hdinfo(off, ih) >= 0)) {
+		if (idx_hdwr(fp, ih) < 0)
+			_exit(1);
+		off = ih->next;
+	}
+	_exit(fflush(fp) != 0);
+}
+
+/*
+ * idx_hdwr()
+ *	write a header found by an index scan worker to fp
+ * Return:
+ *	0 if ok, -1 on error
+ */
+
+static int
+idx_hdwr(FILE *fp, IDXHD *ih)
+{
+	if ((fwrite(ih, offsetof(IDXHD, name), 1, fp) != 1) ||
+	    (fwrite(ih->name, ih->nlen, 1, fp) != (ih->nlen > 0)))
+		return (-1);
+	return (0);
+}
+
+/*
+ * idx_hdrd()
+ *	read the next header written by idx_hdwr() from fp
+ * Return:
+ *	1 if one was read, 0 at the end of the file (or a bad record)
+ */
+
+static int
+idx_hdrd(FILE *fp, IDXHD *ih)
+{
+	if ((fread(ih, offsetof(IDXHD, name), 1, fp) != 1) ||
+	    (ih->nlen < 0) || (ih->nlen > PAXPATHLEN) ||
+	    (fread(ih->name, ih->nlen, 1, fp) != (ih->nlen > 0)))
+		return (0);
+	ih->name[ih->nlen] = '\0';
+	return (1);
+}
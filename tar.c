@@ -40,6 +40,7 @@
 #include <sys/stat.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #if HAVE_GRP_H
 #include <grp.h>
 #endif
@@ -71,6 +72,10 @@ static int ull_oct(unsigned long long, char *, int, int);
 #ifndef SMALL
 static void tar_dbgfld(const char *, const char *, size_t);
 static int rd_xheader(ARCHD *arcn, int, off_t);
+static int sp_add(off_t, off_t);
+static int sp_scan(ARCHD *);
+static int sp_wrhdr(ARCHD *, char *);
+static size_t sp_xrec(char *, const char *, const char *);
 #endif
 
 static uid_t uid_nobody;
@@ -84,6 +89,31 @@ static gid_t gid_warn;
 
 #ifndef SMALL
 char tar_nodir;				/* do not write dirs under old tar */
+char tar_sparse;			/* write sparse files as such (ustar) */
+
+/*
+ * Sparse files are stored in the GNU PAX 1.0 format: an extended header
+ * with GNU.sparse.{major,minor,name,realsize} precedes a regular ustar
+ * member (named dir/GNUSparseFile.0/file) whose data is the map of the
+ * data extents, as decimal numbers each ended by a newline (count, then
+ * offset and size of each extent), padded to a block, followed by the
+ * contents of the extents only.
+ */
+typedef struct {
+	off_t off;			/* offset of extent in the file */
+	off_t len;			/* length of extent */
+} SPEXT;
+static SPEXT *spmap;			/* extents of the current member */
+static size_t nspmap;			/* number of extents in spmap */
+static size_t spmapsz;			/* extents allocated in spmap */
+static char *sptxt;			/* map as stored in the archive */
+static size_t sptxtlen;			/* its length before padding */
+static off_t spdatsz;			/* sum of all extent lengths */
+static char sp_wr;			/* member being written is sparse */
+static char sp_rd;			/* member being read is sparse */
+static int sp_major, sp_minor;		/* GNU.sparse version read */
+static off_t sp_realsize;		/* GNU.sparse.realsize read */
+static char spname[PAXPATHLEN + 1];	/* GNU.sparse.name, or stored name */
 #endif
 char *gnu_name_string;			/* GNU ././@LongLink hackery name */
 char *gnu_link_string;			/* GNU ././@LongLink hackery link */
@@ -361,23 +391,31 @@ tar_opt(void)
 
 	while ((opt = opt_next()) != NULL) {
 		if (strcmp(opt->name, TAR_OPTION) ||
-		    strcmp(opt->value, TAR_NODIR)) {
+		    (strcmp(opt->value, TAR_NODIR) &&
+		    strcmp(opt->value, TAR_SPARSE))) {
 			paxwarn(1, "Unknown tar format -o option/value pair %s=%s",
 			    opt->name, opt->value);
-			paxwarn(1,"%s=%s is the only supported tar format option",
-			    TAR_OPTION, TAR_NODIR);
+			paxwarn(1, "%s=%s and %s=%s are the only supported tar "
+			    "format options", TAR_OPTION, TAR_NODIR,
+			    TAR_OPTION, TAR_SPARSE);
 			return(-1);
 		}
 
 		/*
-		 * we only support one option, and only when writing
+		 * we only support these options when writing
 		 */
 		if ((act != APPND) && (act != ARCHIVE)) {
 			paxwarn(1, "%s=%s is only supported when writing.",
 			    opt->name, opt->value);
 			return(-1);
 		}
-		tar_nodir = 1;
+		if (strcmp(opt->value, TAR_SPARSE))
+			tar_nodir = 1;
+		else if (!HAVE_SEEK_DATA)
+			paxwarn(0, "%s=%s is not supported on this system",
+			    opt->name, opt->value);
+		else
+			tar_sparse = 1;
 	}
 	return(0);
 }
@@ -776,6 +814,11 @@ ustar_rd(ARCHD *arcn, char *buf)
 		return(-1);
 
 #ifndef SMALL
+	sp_rd = 0;
+	sp_major = sp_minor = -1;
+	sp_realsize = 0;
+	spname[0] = '\0';
+
  reset:
 #endif
 	memset(arcn, 0, sizeof(*arcn));
@@ -941,6 +984,19 @@ ustar_rd(ARCHD *arcn, char *buf)
 		arcn->pad = TAR_PAD(arcn->sb.st_size);
 		arcn->skip = arcn->sb.st_size;
 		arcn->sb.st_mode |= S_IFREG;
+#ifndef SMALL
+		/*
+		 * a sparse file: the member data is the map and the data
+		 * extents, so only the name and size seen by the user change
+		 */
+		if ((sp_major == 1) && (sp_minor == 0) && spname[0] &&
+		    (sp_realsize >= 0)) {
+			arcn->nlen = strlcpy(arcn->name, spname,
+			    sizeof(arcn->name));
+			arcn->sb.st_size = sp_realsize;
+			sp_rd = 1;
+		}
+#endif
 		break;
 	}
 	return(0);
@@ -964,10 +1020,16 @@ ustar_wr(ARCHD *arcn)
 	HD_USTAR *hd;
 	const char *name;
 	char *pt, hdblk[sizeof(HD_USTAR)];
+	char *nm = arcn->name;
+	int nlen;
+	off_t size = arcn->sb.st_size;
 	u_long t_uid, t_gid;
 	time_t t_mtime;
 
 	anonarch_init();
+#ifndef SMALL
+	sp_wr = 0;
+#endif
 
 	/*
 	 * check for those filesystem types ustar cannot store
@@ -1004,12 +1066,34 @@ ustar_wr(ARCHD *arcn)
 		arcn->name[arcn->nlen++] = '/';
 		arcn->name[arcn->nlen] = '\0';
 	}
+	nlen = arcn->nlen;
+
+#ifndef SMALL
+	/*
+	 * a sparse file is stored under a made-up name, the real one goes
+	 * into the extended header; if that name does not fit, store the
+	 * file in full
+	 */
+	if (tar_sparse && (arcn->type == PAX_REG) && sp_scan(arcn)) {
+		pt = strrchr(arcn->name, '/');
+		nlen = snprintf(spname, sizeof(spname), "%.*sGNUSparseFile.0/%s",
+		    pt ? (int)(pt + 1 - arcn->name) : 0, arcn->name,
+		    pt ? pt + 1 : arcn->name);
+		if ((nlen < (int)sizeof(spname)) &&
+		    (name_split(spname, nlen) != NULL)) {
+			sp_wr = 1;
+			nm = spname;
+			size = (off_t)(sptxtlen + TAR_PAD(sptxtlen)) + spdatsz;
+		} else
+			nlen = arcn->nlen;
+	}
+#endif
 
 	/*
 	 * split the path name into prefix and name fields (if needed). if
-	 * pt != arcn->name, the name has to be split
+	 * pt != nm, the name has to be split
 	 */
-	if ((pt = name_split(arcn->name, arcn->nlen)) == NULL) {
+	if ((pt = name_split(nm, nlen)) == NULL) {
 		paxwarn(1, "%s name too long for %s %s",
 		    "File", "ustar", arcn->name);
 		return (1);
@@ -1025,13 +1109,13 @@ ustar_wr(ARCHD *arcn)
 	/*
 	 * split the name, or zero out the prefix
 	 */
-	if (pt != arcn->name) {
+	if (pt != nm) {
 		/*
 		 * name was split, pt points at the / where the split is to
 		 * occur, we remove the / and copy the first part to the prefix
 		 */
 		*pt = '\0';
-		fieldcpy(hd->prefix, sizeof(hd->prefix), arcn->name,
+		fieldcpy(hd->prefix, sizeof(hd->prefix), nm,
 		    sizeof(arcn->name));
 		*pt++ = '/';
 	}
@@ -1041,7 +1125,7 @@ ustar_wr(ARCHD *arcn)
 	 * the prefix
 	 */
 	fieldcpy(hd->name, sizeof(hd->name), pt,
-	    sizeof(arcn->name) - (pt - arcn->name));
+	    sizeof(arcn->name) - (pt - nm));
 
 	t_uid   = (anonarch & ANON_UIDGID) ? 0UL : (u_long)arcn->sb.st_uid;
 	t_gid   = (anonarch & ANON_UIDGID) ? 0UL : (u_long)arcn->sb.st_gid;
@@ -1096,8 +1180,8 @@ ustar_wr(ARCHD *arcn)
 			hd->typeflag = CONTTYPE;
 		else
 			hd->typeflag = REGTYPE;
-		arcn->pad = TAR_PAD(arcn->sb.st_size);
-		if (ull_oct(arcn->sb.st_size, hd->size, sizeof(hd->size), 3)) {
+		arcn->pad = TAR_PAD(size);
+		if (ull_oct(size, hd->size, sizeof(hd->size), 3)) {
 			paxwarn(1, "File is too large for %s format %s",
 			    "ustar", arcn->org_name);
 			return (1);
@@ -1182,6 +1266,10 @@ ustar_wr(ARCHD *arcn)
 	}
 #endif
 
+#ifndef SMALL
+	if (sp_wr && (sp_wrhdr(arcn, hdblk) < 0))
+		return(-1);
+#endif
 	if (wr_rdbuf(hdblk, sizeof(HD_USTAR)) < 0)
 		return(-1);
 	if (wr_skip(BLKMULT - sizeof(HD_USTAR)) < 0)
@@ -1325,8 +1413,8 @@ tar_dbgfld(const char *pfx, const char *sp, size_t len)
 /* shortest possible extended record: "5 a=\n" */
 #define MINXHDRSZ	5
 
-/* longest record we'll accept */
-#define MAXXHDRSZ	BLKMULT
+/* longest record we'll accept, enough for a path */
+#define MAXXHDRSZ	(PAXPATHLEN + BLKMULT)
 
 static int
 rd_xheader(ARCHD *arcn, int global, off_t size)
@@ -1407,6 +1495,22 @@ rd_xheader(ARCHD *arcn, int global, off_t size)
 			} else if (!strcmp(keyword, "linkpath")) {
 				arcn->ln_nlen = strlcpy(arcn->ln_name, p,
 				    sizeof(arcn->ln_name));
+			} else if (!strcmp(keyword, "GNU.sparse.major")) {
+				sp_major = (int)strtol(p, NULL, 10);
+			} else if (!strcmp(keyword, "GNU.sparse.minor")) {
+				sp_minor = (int)strtol(p, NULL, 10);
+			} else if (!strcmp(keyword, "GNU.sparse.name")) {
+				strlcpy(spname, p, sizeof(spname));
+			} else if (!strcmp(keyword, "GNU.sparse.realsize")) {
+				errno = 0;
+				sp_realsize = (off_t)strtoll(p, &delim, 10);
+				if ((delim == p) || *delim || errno ||
+				    (sp_realsize < 0)) {
+					paxwarn(1, "Invalid %s %s",
+					    "GNU.sparse.realsize", p);
+					/* extract the member as stored */
+					sp_realsize = -1;
+				}
 			}
 		}
 		p = nextp;
@@ -1417,3 +1521,428 @@ rd_xheader(ARCHD *arcn, int global, off_t size)
 	return (ret);
 }
 #endif
+
+/*
+ * ustar_hdinfo()
+ *	read the ustar header at offset off of a seekable archive straight
+ *	from the archive (see ar_pread()) and fill in ih with what the
+ *	member index needs. GNU long name and extended headers get type
+ *	PAX_GLF and carry the name (and sparse file size) they set for the
+ *	member after them, if any. Unlike ustar_rd(), this does not depend
+ *	on the headers read before, so the parallel index scan can start
+ *	anywhere.
+ * Return:
+ *	offset of the next header, -1 if there is no ustar header at off
+ */
+
+off_t
+ustar_hdinfo(off_t off, IDXHD *ih)
+{
+	char blk[BLKMULT];
+	HD_USTAR *hd = (HD_USTAR *)blk;
+	unsigned long long val;
+	off_t size;
+	int cnt = 0;
+#ifndef SMALL
+	char buf[MAXXHDRSZ + 1];
+	char *p, *q, *end, *key, *spname = NULL;
+	long len;
+	int sp_major = -1, sp_minor = -1;
+	off_t sp_realsize = 0;
+#endif
+
+	if ((ar_pread(blk, BLKMULT, off) != BLKMULT) ||
+	    (ustar_id(blk, BLKMULT) < 0))
+		return (-1);
+	size = (off_t)asc_ull(hd->size, sizeof(hd->size), OCT);
+	val = asc_ull(hd->mtime, sizeof(hd->mtime), OCT);
+	ih->mtime = (val > MAX_TIME_T) ? INT_MAX : (long long)val;
+	ih->off = off;
+	ih->next = off + BLKMULT;
+	ih->size = 0;
+	ih->nlen = 0;
+
+	switch (hd->typeflag) {
+	case FIFOTYPE:
+		ih->type = PAX_FIF;
+		break;
+	case DIRTYPE:
+		ih->type = PAX_DIR;
+		break;
+	case BLKTYPE:
+		ih->type = PAX_BLK;
+		break;
+	case CHRTYPE:
+		ih->type = PAX_CHR;
+		break;
+	case SYMTYPE:
+		ih->type = PAX_SLK;
+		break;
+	case LNKTYPE:
+		ih->type = PAX_HLK;
+		break;
+	case LONGLINKTYPE:
+	case LONGNAMETYPE:
+	case XHDRTYPE:
+	case GHDRTYPE:
+		ih->type = PAX_GLF;
+		ih->size = -1;
+		ih->next += size + TAR_PAD(size);
+		if (hd->typeflag == LONGNAMETYPE) {
+			if ((size <= 0) || (size > PAXPATHLEN) ||
+			    (ar_pread(ih->name, size, off + BLKMULT) != size))
+				return (-1);
+			ih->name[size] = '\0';
+			ih->nlen = strlen(ih->name);
+		}
+#ifndef SMALL
+		/*
+		 * pick the name out of an extended header like rd_xheader()
+		 * does; records we cannot make sense of are left to it
+		 */
+		if ((hd->typeflag != XHDRTYPE) || (size > MAXXHDRSZ) ||
+		    (ar_pread(buf, size, off + BLKMULT) != size))
+			break;
+		buf[size] = '\0';
+		for (p = buf, end = buf + size; p < end; p += len) {
+			len = strtol(p, &key, 10);
+			if ((*key++ != ' ') || (len < MINXHDRSZ) ||
+			    (len > end - p) || (p[len - 1] != '\n') ||
+			    ((q = memchr(key, '=', p + len - key)) == NULL))
+				break;
+			*q++ = p[len - 1] = '\0';
+			if (!strcmp(key, "path"))
+				ih->nlen = strlcpy(ih->name, q,
+				    sizeof(ih->name));
+			else if (!strcmp(key, "GNU.sparse.major"))
+				sp_major = (int)strtol(q, NULL, 10);
+			else if (!strcmp(key, "GNU.sparse.minor"))
+				sp_minor = (int)strtol(q, NULL, 10);
+			else if (!strcmp(key, "GNU.sparse.name"))
+				spname = q;
+			else if (!strcmp(key, "GNU.sparse.realsize"))
+				sp_realsize = (off_t)strtoll(q, NULL, 10);
+		}
+		if ((sp_major == 1) && (sp_minor == 0) && (spname != NULL) &&
+		    (sp_realsize >= 0)) {
+			ih->nlen = strlcpy(ih->name, spname, sizeof(ih->name));
+			ih->size = sp_realsize;
+		}
+#endif
+		break;
+	case CONTTYPE:
+	case AREGTYPE:
+	case REGTYPE:
+	default:
+		ih->type = PAX_REG;
+		ih->size = size;
+		ih->next += size + TAR_PAD(size);
+		break;
+	}
+	if (ih->nlen >= (int)sizeof(ih->name))
+		ih->nlen = sizeof(ih->name) - 1;
+	if (ih->type == PAX_GLF)
+		return (ih->next);
+
+	/*
+	 * the name as ustar_rd() puts it together (the caller strips a
+	 * trailing slash from directories, whatever header named them)
+	 */
+	if (*(hd->prefix) != '\0') {
+		cnt = fieldcpy(ih->name, sizeof(ih->name) - 1,
+		    hd->prefix, sizeof(hd->prefix));
+		ih->name[cnt++] = '/';
+	}
+	ih->nlen = cnt + fieldcpy(ih->name + cnt, sizeof(ih->name) - cnt,
+	    hd->name, sizeof(hd->name));
+	return (ih->next);
+}
+
+#ifndef SMALL
+/*
+ * sp_add()
+ *	append an extent to the sparse map
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+static int
+sp_add(off_t off, off_t len)
+{
+	SPEXT *p;
+
+	if (nspmap == spmapsz) {
+		if ((p = reallocarray(spmap, spmapsz ? 2 * spmapsz : 64,
+		    sizeof(SPEXT))) == NULL) {
+			paxwarn(1, "%s for %s", "Out of memory", "sparse map");
+			return (-1);
+		}
+		spmap = p;
+		spmapsz = spmapsz ? 2 * spmapsz : 64;
+	}
+	spmap[nspmap].off = off;
+	spmap[nspmap].len = len;
+	++nspmap;
+	return (0);
+}
+
+/*
+ * sp_scan()
+ *	find the data extents of the regular file arcn if it has holes,
+ *	using SEEK_DATA and SEEK_HOLE, and build the map to store
+ * Return:
+ *	1 if the file is sparse and the map is set up, 0 otherwise
+ */
+
+static int
+sp_scan(ARCHD *arcn)
+{
+#if HAVE_SEEK_DATA
+	off_t size = arcn->sb.st_size;
+	off_t pos = 0, data, hole;
+	size_t i, len;
+	int fd;
+	char *p;
+
+	/* only files with fewer blocks than their size can have holes */
+	if ((size < 2 * BLKMULT) ||
+	    ((off_t)arcn->sb.st_blocks * 512 >= size))
+		return (0);
+	if ((fd = binopen3(0, arcn->org_name, O_RDONLY, 0)) < 0)
+		return (0);
+	nspmap = 0;
+	spdatsz = 0;
+	while (pos < size) {
+		if ((data = lseek(fd, pos, SEEK_DATA)) < 0) {
+			if (errno == ENXIO)
+				break;
+			goto out;
+		}
+		if (data >= size)
+			break;
+		if ((hole = lseek(fd, data, SEEK_HOLE)) < 0)
+			goto out;
+		if (hole > size)
+			hole = size;
+		if (sp_add(data, hole - data) < 0)
+			goto out;
+		spdatsz += hole - data;
+		pos = hole;
+	}
+	(void)close(fd);
+	if (spdatsz == size)
+		return (0);
+	/* like GNU tar, mark the end of a file ending in a hole */
+	if ((nspmap == 0) || (spmap[nspmap - 1].off +
+	    spmap[nspmap - 1].len < size))
+		if (sp_add(size, 0) < 0)
+			return (0);
+
+	/* count and two numbers per extent, 20 digits and newline each */
+	len = (2 * nspmap + 1) * 21 + 1;
+	if ((p = realloc(sptxt, len)) == NULL) {
+		paxwarn(1, "%s for %s", "Out of memory", "sparse map");
+		return (0);
+	}
+	sptxt = p;
+	sptxtlen = snprintf(sptxt, len, "%lu\n", (u_long)nspmap);
+	for (i = 0; i < nspmap; ++i)
+		sptxtlen += snprintf(sptxt + sptxtlen, len - sptxtlen,
+		    "%" OT_FMT "\n%" OT_FMT "\n", spmap[i].off, spmap[i].len);
+	return (1);
+
+ out:
+	(void)close(fd);
+	return (0);
+#else
+	return (0);
+#endif
+}
+
+/*
+ * sp_xrec()
+ *	format an extended header record for keyword kw and value val
+ *	into dst (which can be NULL to just get the length)
+ * Return:
+ *	length of the record
+ */
+
+static size_t
+sp_xrec(char *dst, const char *kw, const char *val)
+{
+	size_t len, n, d;
+
+	/* the length includes its own digits */
+	len = strlen(kw) + strlen(val) + 3;
+	for (n = len + 1, d = 10; n >= d; d *= 10)
+		++n;
+	if (dst != NULL)
+		snprintf(dst, n + 1, "%lu %s=%s\n", (u_long)n, kw, val);
+	return (n);
+}
+
+/*
+ * sp_wrhdr()
+ *	write the extended header for the sparse file arcn, based on its
+ *	ustar header block hdblk
+ * Return:
+ *	0 if ok, -1 if the archive write failed
+ */
+
+static int
+sp_wrhdr(ARCHD *arcn, char *hdblk)
+{
+	HD_USTAR *hd;
+	char xblk[sizeof(HD_USTAR)];
+	char xbuf[4 * 64 + PAXPATHLEN];
+	char rsz[24];
+	size_t len = 0;
+
+	(void)snprintf(rsz, sizeof(rsz), "%" OT_FMT, arcn->sb.st_size);
+	len += sp_xrec(xbuf + len, "GNU.sparse.major", "1");
+	len += sp_xrec(xbuf + len, "GNU.sparse.minor", "0");
+	len += sp_xrec(xbuf + len, "GNU.sparse.name", arcn->name);
+	len += sp_xrec(xbuf + len, "GNU.sparse.realsize", rsz);
+
+	memcpy(xblk, hdblk, sizeof(xblk));
+	hd = (HD_USTAR *)xblk;
+	memset(hd->name, 0, sizeof(hd->name));
+	memset(hd->prefix, 0, sizeof(hd->prefix));
+	strncpy(hd->name, "././@PaxHeader", sizeof(hd->name));
+	hd->typeflag = XHDRTYPE;
+	if (ull_oct(len, hd->size, sizeof(hd->size), 3) ||
+	    ul_oct(tar_chksm(xblk, sizeof(HD_USTAR)), hd->chksum,
+	    sizeof(hd->chksum), 3))
+		return (-1);
+	if ((wr_rdbuf(xblk, sizeof(HD_USTAR)) < 0) ||
+	    (wr_skip(BLKMULT - sizeof(HD_USTAR)) < 0) ||
+	    (wr_rdbuf(xbuf, len) < 0) ||
+	    (wr_skip(TAR_PAD(len)) < 0))
+		return (-1);
+	return (0);
+}
+
+/*
+ * ustar_wrdata()
+ *	write the data of a ustar member: the map and the data extents
+ *	for a sparse file, all of it otherwise
+ * Return:
+ *	0, unless archive write failed. left is set to the number of bytes
+ *	still to be padded
+ */
+
+int
+ustar_wrdata(ARCHD *arcn, int ifd, off_t *left)
+{
+	size_t i;
+	off_t rem = spdatsz;
+
+	if (!sp_wr)
+		return (wr_rdfile(arcn, ifd, left));
+
+	*left = (off_t)(sptxtlen + TAR_PAD(sptxtlen)) + spdatsz;
+	if ((wr_rdbuf(sptxt, sptxtlen) < 0) ||
+	    (wr_skip(TAR_PAD(sptxtlen)) < 0))
+		return (-1);
+	for (i = 0; i < nspmap; ++i) {
+		if (wr_rdextent(arcn, ifd, spmap[i].off, spmap[i].len,
+		    left) < 0) {
+			*left += rem - spmap[i].len;
+			return (-1);
+		}
+		rem -= spmap[i].len - *left;
+		if (*left) {
+			/* short read: the caller pads the rest */
+			*left = rem;
+			return (0);
+		}
+	}
+	*left = 0;
+	return (0);
+}
+
+/*
+ * ustar_rddata()
+ *	extract the data of a ustar member: recreate the holes of a sparse
+ *	file from its map, otherwise just copy all of it
+ * Return:
+ *	0 ok, -1 if archive read failure. if we cannot write the entire
+ *	file, we return a 0 but left is set to the amount unprocessed
+ */
+
+int
+ustar_rddata(ARCHD *arcn, int ofd, off_t *left)
+{
+	char blk[BLKMULT];
+	off_t rem = arcn->skip;
+	off_t num = 0, end = 0, cnt;
+	long nums = -1, want = 1;
+	int i, n, dig = 0;
+
+	if (!sp_rd || (ofd < 0))
+		return (rd_wrfile(arcn, ofd, left));
+
+	/* parse the map, block by block */
+	nspmap = 0;
+	*left = rem;
+	while (nums < want) {
+		if (rem < BLKMULT)
+			goto bad;
+		if ((n = rd_wrbuf(blk, BLKMULT)) != BLKMULT)
+			return (-1);
+		rem -= BLKMULT;
+		/* the caller skips what is left, also if the map is bad */
+		*left = rem;
+		for (i = 0; (i < n) && (nums < want); ++i) {
+			if ((blk[i] >= '0') && (blk[i] <= '9')) {
+				if (num > (off_t)(INT64_MAX / 10 - 10))
+					goto bad;
+				num = num * 10 + (blk[i] - '0');
+				dig = 1;
+				continue;
+			}
+			if ((blk[i] != '\n') || !dig)
+				goto bad;
+			if (nums == -1) {
+				if (num > rem)
+					goto bad;
+				want = 2 * (long)num;
+			} else if (nums & 1) {
+				/* extents must be ascending and in the file */
+				if ((num > rem) || (num > sp_realsize - end) ||
+				    (sp_add(end, num) < 0))
+					goto bad;
+				end += num;
+			} else {
+				if (num < end)
+					goto bad;
+				end = num;
+			}
+			++nums;
+			num = 0;
+			dig = 0;
+		}
+	}
+	if (end > sp_realsize)
+		goto bad;
+
+	for (i = 0; (size_t)i < nspmap; ++i) {
+		if (spmap[i].len > rem)
+			goto bad;
+		if (rd_wrextent(arcn, ofd, spmap[i].off, spmap[i].len,
+		    &cnt) < 0)
+			return (-1);
+		rem -= spmap[i].len - cnt;
+		*left = rem;
+		if (cnt)
+			return (0);
+	}
+	if (ftruncate(ofd, sp_realsize) < 0)
+		syswarn(1, errno, "Failed truncate on file %s", arcn->name);
+	return (0);
+
+ bad:
+	paxwarn(1, "Invalid sparse map for %s", arcn->name);
+	return (0);
+}
+#endif
@@ -118,9 +118,11 @@ typedef struct {
 
 #ifdef _PAX_
 /*
- * -o options for BSD tar to not write directories to the archive
+ * -o options for BSD tar to not write directories to the archive,
+ * and for ustar to write sparse files in the GNU PAX 1.0 format
  */
 #define TAR_NODIR	"nodir"
+#define TAR_SPARSE	"sparse"
 #define TAR_OPTION	"write_opt"
 
 /*